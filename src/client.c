@@ -0,0 +1,306 @@
+#include "client.h"
+#include <string.h>
+
+net_packet_t client_packet;
+// Snapshots are read here first, a packet cut short must not cost the slot
+// its previous snapshot
+net_snapshot_t client_scratch;
+
+int connect_client(client_t *client, char *host, int port) {
+    memset(client, 0, sizeof(client_t));
+    client->slot = -1;
+    for (int i = 0; i < NET_HISTORY; i++)
+        client->snapshots[i].tick = -1;
+
+    if (net_resolve(host, port, &client->server))
+        return 1;
+    client->socket = net_open_socket(0);
+    if (client->socket < 0)
+        return 1;
+    return 0;
+}
+
+// Sent every frame, until the server answers it asks to join instead
+void client_send_input(client_t *client, ship_t *ship, int thrust) {
+    if (client->slot < 0) {
+        net_begin(&client_packet, NET_CONNECT);
+        net_write_byte(&client_packet, NET_PROTOCOL_VERSION);
+    } else {
+        client->input.ack_tick = client->latest_tick;
+        for (int i = 0; i < 3; i++)
+            client->input.pointing[i] = net_snorm(ship->pointing_direction[i]);
+        client->input.thrust = thrust;
+        net_begin(&client_packet, NET_INPUT);
+        net_write_input(&client_packet, &client->input);
+    }
+    net_send(client->socket, &client->server, &client_packet);
+}
+
+void receive_welcome(client_t *client, net_packet_t *packet) {
+    int slot = net_read_byte(packet);
+    int tick_rate = net_read_byte(packet);
+    if (packet->overflow || slot >= NET_MAX_CLIENTS)
+        return;
+    if (tick_rate != NET_TICK_RATE) {
+        fprintf(stderr, "Server ticks at %i Hz instead of %i Hz\n", tick_rate, NET_TICK_RATE);
+        return;
+    }
+    client->slot = slot;
+}
+
+bool receive_snapshot(client_t *client, net_packet_t *packet, double now) {
+    int tick, baseline_tick;
+    net_read_snapshot_header(packet, &tick, &baseline_tick);
+    if (packet->overflow || tick <= 0 || tick <= client->latest_tick - NET_HISTORY)
+        return false;
+
+    net_snapshot_t *snapshot = &client->snapshots[tick % NET_HISTORY];
+    if (snapshot->tick == tick)
+        return false;
+
+    // A delta against a snapshot this client no longer has cannot be read
+    net_snapshot_t *baseline = NULL;
+    if (baseline_tick > 0) {
+        baseline = &client->snapshots[baseline_tick % NET_HISTORY];
+        if (tick - baseline_tick >= NET_HISTORY || baseline->tick != baseline_tick)
+            return false;
+    }
+
+    net_read_snapshot(packet, tick, baseline, &client_scratch);
+    if (packet->overflow)
+        return false;
+    net_copy_snapshot(&client_scratch, snapshot);
+
+    client->snapshots_received++;
+    if (tick > client->latest_tick) {
+        client->latest_tick = tick;
+        client->latest_time = now;
+    }
+    return true;
+}
+
+// Reads everything that arrived, returns the number of new snapshots
+int client_receive(client_t *client, double now) {
+    int received = 0;
+    struct sockaddr_in address;
+    while (net_receive(client->socket, &address, &client_packet) >= 0) {
+        client->bytes_received += client_packet.length + NET_PACKET_OVERHEAD;
+        unsigned int type = net_read_byte(&client_packet);
+        if (type == NET_WELCOME)
+            receive_welcome(client, &client_packet);
+        else if (type == NET_SNAPSHOT)
+            received += receive_snapshot(client, &client_packet, now);
+    }
+    return received;
+}
+
+net_snapshot_t *client_latest_snapshot(client_t *client) {
+    if (client->latest_tick == 0)
+        return NULL;
+    return &client->snapshots[client->latest_tick % NET_HISTORY];
+}
+
+// Where an entity is at the drawn tick, blended from what the two snapshots
+// around it say. Either may be missing when the entity appeared in between.
+void sample_entity(net_entity_t *from, net_entity_t *to, float tick, float alpha, vec3 location, float *angle) {
+    net_reckon_smooth(to, tick, location, angle);
+    if (!from)
+        return;
+
+    vec3 from_location;
+    float from_angle;
+    net_reckon_smooth(from, tick, from_location, &from_angle);
+
+    // Wrapping around the edge of the world is a jump, not a move
+    if (glm_vec3_distance2(from_location, location) > 100.0f * 100.0f) {
+        if (alpha < 0.5f) {
+            glm_vec3_copy(from_location, location);
+            *angle = from_angle;
+        }
+        return;
+    }
+
+    glm_vec3_lerp(from_location, location, alpha, location);
+    float turn = *angle - from_angle;
+    turn -= 2.0f * GLM_PIf * roundf(turn / (2.0f * GLM_PIf));
+    *angle = from_angle + turn * alpha;
+}
+
+// The lists always have room for the sentinel node, even when empty
+void reserve_asteroids(client_t *client, int buffer, int length) {
+    if (client->asteroid_nodes && length <= client->asteroids_capacity[buffer])
+        return;
+    while (client->asteroids_capacity[buffer] < length)
+        client->asteroids_capacity[buffer] = client->asteroids_capacity[buffer] ? client->asteroids_capacity[buffer] * 2 : 256;
+    client->asteroids[buffer] = realloc(client->asteroids[buffer], client->asteroids_capacity[buffer] * sizeof(asteroid_t));
+    // Both buffers share the nodes, size them for the larger one
+    int nodes = fmax(client->asteroids_capacity[0], client->asteroids_capacity[1]) + 1;
+    client->asteroid_nodes = realloc(client->asteroid_nodes, nodes * sizeof(asteroid_list_t));
+}
+
+void reserve_bullets(client_t *client, int length) {
+    if (client->bullet_nodes && length <= client->bullets_capacity)
+        return;
+    while (client->bullets_capacity < length)
+        client->bullets_capacity = client->bullets_capacity ? client->bullets_capacity * 2 : 256;
+    client->bullets = realloc(client->bullets, client->bullets_capacity * sizeof(bullet_t));
+    client->bullet_nodes = realloc(client->bullet_nodes, (client->bullets_capacity + 1) * sizeof(bullet_list_t));
+}
+
+void velocity_to_direction(int32_t *quantized, vec3 direction, float *speed) {
+    net_dequantize_velocity(quantized, direction);
+    *speed = glm_vec3_norm(direction);
+    glm_vec3_normalize(direction);
+}
+
+void build_asteroids(client_t *client, world_t *world, net_snapshot_t *from, net_snapshot_t *to,
+                     float tick, float alpha, vec3 moved) {
+    int previous = client->current, next = !client->current;
+    net_snapshot_t *shown = to ? to : from;
+    reserve_asteroids(client, next, shown->asteroids_length);
+
+    asteroid_t *asteroids = client->asteroids[next];
+    for (int i = 0; i < shown->asteroids_length; i++) {
+        net_entity_t *entity = &shown->asteroids[i];
+        net_entity_t *before = to ? net_find_entity(from->asteroids, from->asteroids_length, entity->id) : NULL;
+        asteroid_t *asteroid = &asteroids[i];
+
+        asteroid->id = entity->id;
+        asteroid->shape = entity->shape % SHAPE_BANK_LENGTH;
+        asteroid->size = entity->size / NET_SIZE_SCALE;
+        net_unsnorm(entity->axis, asteroid->axis);
+        asteroid->rotation_speed = net_dequantize_spin(entity->spin);
+        velocity_to_direction(entity->velocity, asteroid->direction, &asteroid->speed);
+        sample_entity(before, entity, tick, alpha, asteroid->location, &asteroid->angle);
+        glm_vec3_sub(asteroid->location, client->own_location, asteroid->location);
+    }
+    client->asteroids_length[next] = shown->asteroids_length;
+
+    // Asteroids only disappear when shot, leave debris where they were drawn
+    asteroid_t *drawn = client->asteroids[previous];
+    for (int i = 0, j = 0; i < client->asteroids_length[previous]; i++) {
+        while (j < shown->asteroids_length && asteroids[j].id < drawn[i].id)
+            j++;
+        if (j < shown->asteroids_length && asteroids[j].id == drawn[i].id)
+            continue;
+        vec3 location, velocity;
+        glm_vec3_sub(drawn[i].location, moved, location);
+        glm_vec3_scale(drawn[i].direction, drawn[i].speed, velocity);
+        add_debris_burst(world, location, velocity, drawn[i].size);
+    }
+    client->current = next;
+
+    asteroid_list_t *nodes = client->asteroid_nodes;
+    for (int i = 0; i < shown->asteroids_length; i++) {
+        nodes[i].this = &asteroids[i];
+        nodes[i].next = &nodes[i + 1];
+    }
+    nodes[shown->asteroids_length].this = NULL;
+    nodes[shown->asteroids_length].next = NULL;
+    world->asteroids = nodes;
+}
+
+void build_bullets(client_t *client, world_t *world, net_snapshot_t *from, net_snapshot_t *to,
+                   float tick, float alpha) {
+    net_snapshot_t *shown = to ? to : from;
+    reserve_bullets(client, shown->bullets_length);
+
+    for (int i = 0; i < shown->bullets_length; i++) {
+        net_entity_t *entity = &shown->bullets[i];
+        net_entity_t *before = to ? net_find_entity(from->bullets, from->bullets_length, entity->id) : NULL;
+        bullet_t *bullet = &client->bullets[i];
+        float angle;
+
+        bullet->id = entity->id;
+        velocity_to_direction(entity->velocity, bullet->direction, &bullet->speed);
+        glm_vec3_copy(GLM_VEC3_ZERO, bullet->vertices[0]);
+        glm_vec3_copy(bullet->direction, bullet->vertices[1]);
+        sample_entity(before, entity, tick, alpha, bullet->location, &angle);
+        glm_vec3_sub(bullet->location, client->own_location, bullet->location);
+
+        client->bullet_nodes[i].this = bullet;
+        client->bullet_nodes[i].next = &client->bullet_nodes[i + 1];
+    }
+    client->bullet_nodes[shown->bullets_length].this = NULL;
+    client->bullet_nodes[shown->bullets_length].next = NULL;
+    world->bullets = client->bullet_nodes;
+}
+
+void sample_ship(net_snapshot_t *from, net_snapshot_t *to, int slot, float tick, float alpha, vec3 location) {
+    net_snapshot_t *shown = to ? to : from;
+    net_entity_t *before = to && from->ships[slot].connected ? &from->ships[slot].state : NULL;
+    float angle;
+    sample_entity(before, &shown->ships[slot].state, tick, alpha, location, &angle);
+}
+
+// Fills the world's lists with what the server says, relative to the own ship
+// like in the normal game, so the renderer and particles need no changes. The
+// world's own ship keeps its local pointing direction.
+void client_build_world(client_t *client, world_t *world, double now) {
+    if (client->latest_tick == 0 || client->slot < 0)
+        return;
+
+    // The two snapshots around the drawn tick, or the newest when none is
+    // newer than it yet, reckoning forward from there
+    float tick = client->latest_tick + (now - client->latest_time) * NET_TICK_RATE - CLIENT_INTERPOLATION_TICKS;
+    net_snapshot_t *from = NULL, *to = NULL;
+    for (int t = client->latest_tick; t > 0 && t > client->latest_tick - NET_HISTORY; t--) {
+        net_snapshot_t *snapshot = &client->snapshots[t % NET_HISTORY];
+        if (snapshot->tick != t)
+            continue;
+        if (t <= tick) {
+            from = snapshot;
+            break;
+        }
+        to = snapshot;
+    }
+    if (!from && !to)
+        return;
+    if (!from) {
+        from = to;
+        to = NULL;
+        tick = from->tick;
+    }
+    float alpha = to ? (tick - from->tick) / (to->tick - from->tick) : 0.0f;
+    net_snapshot_t *shown = to ? to : from;
+
+    net_ship_t *own = &shown->ships[client->slot];
+    if (!own->connected)
+        return;
+
+    vec3 location, moved = GLM_VEC3_ZERO_INIT;
+    sample_ship(from, to, client->slot, tick, alpha, location);
+    if (client->own_location_known)
+        glm_vec3_sub(location, client->own_location, moved);
+    glm_vec3_copy(location, client->own_location);
+    client->own_location_known = true;
+
+    // Dust stays put in the world, unless the ship wrapped around
+    if (glm_vec3_norm(moved) < max_distance / 2.0f) {
+        for (int i = 0; i < world->dust_cloud->vertices_length; i++) {
+            glm_vec3_sub(world->dust_cloud->vertices[i], moved, world->dust_cloud->vertices[i]);
+            if (glm_vec3_norm(world->dust_cloud->vertices[i]) > max_distance)
+                glm_vec3_negate(world->dust_cloud->vertices[i]);
+        }
+    } else
+        glm_vec3_copy(GLM_VEC3_ZERO, moved);
+
+    build_asteroids(client, world, from, to, tick, alpha, moved);
+    build_bullets(client, world, from, to, tick, alpha);
+
+    world->peers_length = 0;
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        if (i == client->slot || !shown->ships[i].connected || !shown->ships[i].alive)
+            continue;
+        peer_t *peer = &world->peers[world->peers_length++];
+        sample_ship(from, to, i, tick, alpha, peer->location);
+        glm_vec3_sub(peer->location, client->own_location, peer->location);
+        net_unsnorm(shown->ships[i].state.axis, peer->pointing_direction);
+    }
+
+    world->score = shown->score;
+    world->running = own->alive;
+    net_dequantize_velocity(own->state.velocity, world->ship->movement_direction);
+    if (own->alive)
+        client->input.respawn = false;
+}
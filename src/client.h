@@ -0,0 +1,44 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "net.h"
+#include "world.h"
+
+// Snapshots are drawn this far in the past so there is usually a newer one to
+// interpolate towards
+#define CLIENT_INTERPOLATION_TICKS 2.0f
+
+typedef struct {
+    int socket;
+    struct sockaddr_in server;
+    // Ship slot given by the server, -1 until welcomed
+    int slot;
+    net_input_t input;
+
+    // Decoded snapshots by tick, also the baselines of the server's deltas
+    net_snapshot_t snapshots[NET_HISTORY];
+    int latest_tick;
+    double latest_time;
+    long bytes_received;
+    int snapshots_received;
+
+    // What the world was built from last frame, asteroids sorted by id
+    asteroid_t *asteroids[2];
+    int asteroids_length[2];
+    int asteroids_capacity[2];
+    int current;
+    asteroid_list_t *asteroid_nodes;
+    bullet_t *bullets;
+    bullet_list_t *bullet_nodes;
+    int bullets_capacity;
+    vec3 own_location;
+    bool own_location_known;
+} client_t;
+
+int connect_client(client_t *, char *, int);
+void client_send_input(client_t *, ship_t *, int);
+int client_receive(client_t *, double);
+net_snapshot_t *client_latest_snapshot(client_t *);
+void client_build_world(client_t *, world_t *, double);
+
+#endif
@@ -0,0 +1,611 @@
+#include "collision.h"
+#include <stdint.h>
+#include <string.h>
+
+// Incremental sweep-and-prune. Every asteroid's bounding box has its two
+// ends in a sorted list per axis, kept across ticks. Rocks barely move in
+// one tick, so an insertion sort puts the lists right again in close to
+// linear time, and two boxes can only start or stop overlapping when their
+// ends swap places. Those swaps keep a set of overlapping pairs up to date,
+// which is all the narrow-phase looks at.
+typedef struct {
+    asteroid_t *asteroid;
+    float min[3];
+    float max[3];
+    // Bounds as of last tick, which the pair set still matches
+    float previous_min[3];
+    float previous_max[3];
+} sweep_object_t;
+
+// tag is the object's index times two, plus one for the box's upper end
+typedef struct {
+    float value;
+    int tag;
+} sweep_endpoint_t;
+
+typedef struct {
+    int a;
+    int b;
+} sweep_pair_t;
+
+sweep_object_t *sweep_objects = NULL;
+int sweep_objects_length = 0, sweep_objects_capacity = 0;
+
+sweep_endpoint_t *sweep_endpoints[3] = {NULL, NULL, NULL};
+
+// Widest box along x, bounds how far back a query has to start looking
+float sweep_widest = 0.0f;
+
+// Overlapping pairs, with an open addressing table of indices into them
+sweep_pair_t *sweep_pairs = NULL;
+int sweep_pairs_length = 0, sweep_pairs_capacity = 0;
+int *pair_table = NULL;
+int pair_table_capacity = 0;
+
+// This tick's asteroids by address, to match them up with the objects
+asteroid_t **live_table = NULL;
+bool *live_found = NULL;
+int live_table_capacity = 0;
+
+unsigned int hash_bits(uint64_t bits) {
+    unsigned int hash = (unsigned int) (bits ^ (bits >> 32));
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+unsigned int pair_hash(int a, int b) {
+    return hash_bits(((uint64_t) a << 32) | (unsigned int) b);
+}
+
+// Slot holding the pair, or the empty slot it would go in
+int pair_slot(int a, int b) {
+    int mask = pair_table_capacity - 1;
+    int slot = pair_hash(a, b) & mask;
+    while (pair_table[slot] != -1) {
+        sweep_pair_t *pair = &sweep_pairs[pair_table[slot]];
+        if (pair->a == a && pair->b == b)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Slot holding the asteroid, or the empty slot it would go in
+int live_slot(asteroid_t *asteroid) {
+    int mask = live_table_capacity - 1;
+    int slot = hash_bits((uintptr_t) asteroid >> 4) & mask;
+    while (live_table[slot] != NULL && live_table[slot] != asteroid)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void rebuild_pair_table(int capacity) {
+    free(pair_table);
+    pair_table_capacity = capacity;
+    pair_table = malloc(pair_table_capacity * sizeof(int));
+    memset(pair_table, -1, pair_table_capacity * sizeof(int));
+    for (int i = 0; i < sweep_pairs_length; i++)
+        pair_table[pair_slot(sweep_pairs[i].a, sweep_pairs[i].b)] = i;
+}
+
+void add_pair(int a, int b) {
+    if (a > b) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    if (pair_table[pair_slot(a, b)] != -1)
+        return;
+
+    if (sweep_pairs_length == sweep_pairs_capacity) {
+        sweep_pairs_capacity = sweep_pairs_capacity ? sweep_pairs_capacity * 2 : 256;
+        sweep_pairs = realloc(sweep_pairs, sweep_pairs_capacity * sizeof(sweep_pair_t));
+    }
+    sweep_pairs[sweep_pairs_length] = (sweep_pair_t) {a, b};
+    sweep_pairs_length++;
+    if (sweep_pairs_length * 2 > pair_table_capacity)
+        rebuild_pair_table(pair_table_capacity * 2);
+    else
+        pair_table[pair_slot(a, b)] = sweep_pairs_length - 1;
+}
+
+void remove_pair(int a, int b) {
+    if (a > b) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    int slot = pair_slot(a, b);
+    int index = pair_table[slot];
+    if (index == -1)
+        return;
+
+    // Close the gap in the table by shifting back entries that probed past it
+    int mask = pair_table_capacity - 1;
+    int hole = slot;
+    for (int next = (slot + 1) & mask; pair_table[next] != -1; next = (next + 1) & mask) {
+        sweep_pair_t *pair = &sweep_pairs[pair_table[next]];
+        int home = pair_hash(pair->a, pair->b) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            pair_table[hole] = pair_table[next];
+            hole = next;
+        }
+    }
+    pair_table[hole] = -1;
+
+    // Move the last pair into the freed spot
+    sweep_pairs_length--;
+    if (index != sweep_pairs_length) {
+        sweep_pair_t last = sweep_pairs[sweep_pairs_length];
+        pair_table[pair_slot(last.a, last.b)] = index;
+        sweep_pairs[index] = last;
+    }
+}
+
+bool boxes_overlap(sweep_object_t *a, sweep_object_t *b) {
+    for (int axis = 0; axis < 3; axis++)
+        if (a->max[axis] < b->min[axis] || b->max[axis] < a->min[axis])
+            return false;
+    return true;
+}
+
+bool boxes_overlapped(sweep_object_t *a, sweep_object_t *b) {
+    for (int axis = 0; axis < 3; axis++)
+        if (a->previous_max[axis] < b->previous_min[axis] || b->previous_max[axis] < a->previous_min[axis])
+            return false;
+    return true;
+}
+
+void update_bounds(sweep_object_t *object) {
+    asteroid_t *asteroid = object->asteroid;
+    float radius = shape_bank[asteroid->shape].bounding_radius * asteroid->size;
+    for (int axis = 0; axis < 3; axis++) {
+        object->previous_min[axis] = object->min[axis];
+        object->previous_max[axis] = object->max[axis];
+        object->min[axis] = asteroid->location[axis] - radius;
+        object->max[axis] = asteroid->location[axis] + radius;
+    }
+}
+
+// New objects have no last tick, they count as having been where they are
+void set_bounds(sweep_object_t *object) {
+    update_bounds(object);
+    update_bounds(object);
+}
+
+void refresh_endpoints(int axis) {
+    sweep_endpoint_t *endpoints = sweep_endpoints[axis];
+    for (int i = 0; i < sweep_objects_length * 2; i++) {
+        sweep_object_t *object = &sweep_objects[endpoints[i].tag >> 1];
+        endpoints[i].value = endpoints[i].tag & 1 ? object->max[axis] : object->min[axis];
+    }
+}
+
+// An endpoint moving down past another is the only time overlap can change:
+// a lower end passing an upper end may start one, the reverse ends it. Only
+// boxes that overlapped last tick can be in the set, so most swaps never
+// have to look in the pair table.
+void sort_axis(int axis, bool update_pairs) {
+    sweep_endpoint_t *endpoints = sweep_endpoints[axis];
+    for (int i = 1; i < sweep_objects_length * 2; i++) {
+        sweep_endpoint_t endpoint = endpoints[i];
+        int j = i;
+        while (j > 0 && endpoints[j-1].value > endpoint.value) {
+            sweep_endpoint_t passed = endpoints[j-1];
+            if (update_pairs && (endpoint.tag & 1) != (passed.tag & 1)) {
+                int a = endpoint.tag >> 1;
+                int b = passed.tag >> 1;
+                if (endpoint.tag & 1) {
+                    if (boxes_overlapped(&sweep_objects[a], &sweep_objects[b]))
+                        remove_pair(a, b);
+                }
+                else if (boxes_overlap(&sweep_objects[a], &sweep_objects[b]))
+                    add_pair(a, b);
+            }
+            endpoints[j] = passed;
+            j--;
+        }
+        endpoints[j] = endpoint;
+    }
+}
+
+void reserve_objects(int length) {
+    if (sweep_objects_capacity >= length)
+        return;
+    sweep_objects_capacity = length * 2;
+    sweep_objects = realloc(sweep_objects, sweep_objects_capacity * sizeof(sweep_object_t));
+    for (int axis = 0; axis < 3; axis++)
+        sweep_endpoints[axis] = realloc(sweep_endpoints[axis], sweep_objects_capacity * 2 * sizeof(sweep_endpoint_t));
+}
+
+// Wrapping around the edge of the world takes a rock right across every
+// list, cheaper to take it out and put it back in as if it were new
+bool jumped(sweep_object_t *object) {
+    asteroid_t *asteroid = object->asteroid;
+    for (int axis = 0; axis < 3; axis++) {
+        float width = object->max[axis] - object->min[axis];
+        float center = (object->max[axis] + object->min[axis]) / 2.0f;
+        if (fabsf(asteroid->location[axis] - center) > width)
+            return true;
+    }
+    return false;
+}
+
+// Drops every object not in the live table or that jumped, renumbering the
+// rest. Whatever is live but not found afterwards gets added as new.
+void remove_stale_objects() {
+    int *renumber = malloc(sweep_objects_length * sizeof(int));
+    int length = 0;
+    for (int i = 0; i < sweep_objects_length; i++) {
+        int slot = live_slot(sweep_objects[i].asteroid);
+        if (live_table[slot] != NULL && !live_found[slot] && !jumped(&sweep_objects[i])) {
+            live_found[slot] = true;
+            renumber[i] = length;
+            sweep_objects[length++] = sweep_objects[i];
+        } else
+            renumber[i] = -1;
+    }
+    if (length == sweep_objects_length) {
+        free(renumber);
+        return;
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        sweep_endpoint_t *endpoints = sweep_endpoints[axis];
+        int kept = 0;
+        for (int i = 0; i < sweep_objects_length * 2; i++) {
+            int object = renumber[endpoints[i].tag >> 1];
+            if (object != -1) {
+                endpoints[kept].value = endpoints[i].value;
+                endpoints[kept++].tag = object * 2 + (endpoints[i].tag & 1);
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < sweep_pairs_length; i++) {
+        int a = renumber[sweep_pairs[i].a];
+        int b = renumber[sweep_pairs[i].b];
+        if (a != -1 && b != -1)
+            sweep_pairs[kept++] = (sweep_pair_t) {a, b};
+    }
+    sweep_pairs_length = kept;
+    rebuild_pair_table(pair_table_capacity);
+
+    sweep_objects_length = length;
+    free(renumber);
+}
+
+int compare_endpoints(const void *a, const void *b) {
+    float value_a = ((sweep_endpoint_t*) a)->value;
+    float value_b = ((sweep_endpoint_t*) b)->value;
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+// From scratch, for when nearly everything is new after a restart or
+// snapshot load and inserting one by one would go quadratic
+void rebuild_sweep(int first_new) {
+    for (int i = first_new; i < sweep_objects_length; i++)
+        set_bounds(&sweep_objects[i]);
+    sweep_pairs_length = 0;
+    rebuild_pair_table(pair_table_capacity);
+
+    for (int axis = 0; axis < 3; axis++) {
+        for (int i = 0; i < sweep_objects_length * 2; i++)
+            sweep_endpoints[axis][i].tag = i;
+        refresh_endpoints(axis);
+        qsort(sweep_endpoints[axis], sweep_objects_length * 2, sizeof(sweep_endpoint_t), compare_endpoints);
+    }
+
+    // One sweep along x, pairing each box with those whose lower end comes
+    // before its upper end
+    sweep_endpoint_t *endpoints = sweep_endpoints[0];
+    for (int i = 0; i < sweep_objects_length * 2; i++) {
+        if (endpoints[i].tag & 1)
+            continue;
+        int a = endpoints[i].tag >> 1;
+        for (int j = i + 1; (endpoints[j].tag >> 1) != a; j++)
+            if (!(endpoints[j].tag & 1) && boxes_overlap(&sweep_objects[a], &sweep_objects[endpoints[j].tag >> 1]))
+                add_pair(a, endpoints[j].tag >> 1);
+    }
+}
+
+// Puts an endpoint into place among the first length, which are sorted
+void insert_endpoint(int axis, int length, sweep_endpoint_t endpoint) {
+    sweep_endpoint_t *endpoints = sweep_endpoints[axis];
+    int low = 0, high = length;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (endpoints[middle].value <= endpoint.value)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    memmove(&endpoints[low + 1], &endpoints[low], (length - low) * sizeof(sweep_endpoint_t));
+    endpoints[low] = endpoint;
+}
+
+// New boxes go straight into place in every list and are paired by checking
+// them against everything, linear per new box either way
+void insert_new_objects(int first_new) {
+    for (int i = first_new; i < sweep_objects_length; i++) {
+        sweep_object_t *object = &sweep_objects[i];
+        set_bounds(object);
+        for (int axis = 0; axis < 3; axis++) {
+            insert_endpoint(axis, i * 2, (sweep_endpoint_t) {object->min[axis], i * 2});
+            insert_endpoint(axis, i * 2 + 1, (sweep_endpoint_t) {object->max[axis], i * 2 + 1});
+        }
+        for (int j = 0; j < i; j++)
+            if (boxes_overlap(object, &sweep_objects[j]))
+                add_pair(i, j);
+    }
+}
+
+void sync_sweep_objects(world_t *world) {
+    int asteroids_length = 0;
+    for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next)
+        asteroids_length++;
+
+    if (live_table_capacity < asteroids_length * 2) {
+        while (live_table_capacity < asteroids_length * 2)
+            live_table_capacity = live_table_capacity ? live_table_capacity * 2 : 256;
+        free(live_table);
+        free(live_found);
+        live_table = malloc(live_table_capacity * sizeof(asteroid_t*));
+        live_found = malloc(live_table_capacity * sizeof(bool));
+    }
+    if (!pair_table)
+        rebuild_pair_table(512);
+    reserve_objects(asteroids_length);
+
+    memset(live_table, 0, live_table_capacity * sizeof(asteroid_t*));
+    memset(live_found, 0, live_table_capacity * sizeof(bool));
+    for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next)
+        live_table[live_slot(head->this)] = head->this;
+    remove_stale_objects();
+
+    // Everything already tracked moves first, then the newcomers are added
+    int kept = sweep_objects_length;
+    for (int i = 0; i < kept; i++)
+        update_bounds(&sweep_objects[i]);
+    for (int axis = 0; axis < 3; axis++) {
+        refresh_endpoints(axis);
+        sort_axis(axis, true);
+    }
+
+    // In list order, so the simulation does not depend on where malloc put things
+    for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next) {
+        int slot = live_slot(head->this);
+        if (!live_found[slot]) {
+            live_found[slot] = true;
+            sweep_objects[sweep_objects_length++].asteroid = head->this;
+        }
+    }
+    if (sweep_objects_length - kept > kept / 8 + 16)
+        rebuild_sweep(kept);
+    else if (sweep_objects_length > kept)
+        insert_new_objects(kept);
+
+    sweep_widest = 0.0f;
+    for (int i = 0; i < sweep_objects_length; i++)
+        sweep_widest = fmaxf(sweep_widest, sweep_objects[i].max[0] - sweep_objects[i].min[0]);
+}
+
+void set_velocity(asteroid_t *asteroid, vec3 velocity) {
+    asteroid->speed = glm_vec3_norm(velocity);
+    if (asteroid->speed > 0.0f)
+        glm_vec3_scale(velocity, 1.0f / asteroid->speed, asteroid->direction);
+}
+
+// Elastic bounce between spheres of the average shape radius, masses grow
+// with volume
+void bounce_asteroids(asteroid_t *a, asteroid_t *b) {
+    vec3 normal;
+    glm_vec3_sub(b->location, a->location, normal);
+    float distance = glm_vec3_norm(normal);
+    if (distance >= ASTEROID_SIZE * (a->size + b->size) || distance < 0.001f)
+        return;
+    glm_vec3_scale(normal, 1.0f / distance, normal);
+
+    vec3 velocity_a, velocity_b, relative;
+    glm_vec3_scale(a->direction, a->speed, velocity_a);
+    glm_vec3_scale(b->direction, b->speed, velocity_b);
+    glm_vec3_sub(velocity_a, velocity_b, relative);
+
+    // Already moving apart, like the two halves of a split rock
+    float approach = glm_vec3_dot(relative, normal);
+    if (approach <= 0.0f)
+        return;
+
+    float mass_a = a->size * a->size * a->size;
+    float mass_b = b->size * b->size * b->size;
+    float impulse = 2.0f * approach / (mass_a + mass_b);
+    vec3 change;
+    glm_vec3_scale(normal, impulse * mass_b, change);
+    glm_vec3_sub(velocity_a, change, velocity_a);
+    glm_vec3_scale(normal, impulse * mass_a, change);
+    glm_vec3_add(velocity_b, change, velocity_b);
+
+    set_velocity(a, velocity_a);
+    set_velocity(b, velocity_b);
+}
+
+void collide_asteroids(world_t *world) {
+    sync_sweep_objects(world);
+    for (int i = 0; i < sweep_pairs_length; i++)
+        bounce_asteroids(sweep_objects[sweep_pairs[i].a].asteroid,
+                         sweep_objects[sweep_pairs[i].b].asteroid);
+}
+
+// Into the asteroid's own space, where its shape can be used as is
+void to_asteroid_space(asteroid_t *asteroid, vec3 point, vec3 dest) {
+    glm_vec3_sub(point, asteroid->location, dest);
+    glm_vec3_rotate(dest, -asteroid->angle, asteroid->axis);
+    glm_vec3_scale(dest, 1.0f / asteroid->size, dest);
+}
+
+void triangle_bounds(vec3 a, vec3 b, vec3 c, vec3 min, vec3 max) {
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = fminf(a[axis], fminf(b[axis], c[axis]));
+        max[axis] = fmaxf(a[axis], fmaxf(b[axis], c[axis]));
+    }
+}
+
+bool bounds_overlap(vec3 min_a, vec3 max_a, vec3 min_b, vec3 max_b) {
+    for (int axis = 0; axis < 3; axis++)
+        if (max_a[axis] < min_b[axis] || max_b[axis] < min_a[axis])
+            return false;
+    return true;
+}
+
+bool separated_on(vec3 axis, vec3 *a, vec3 *b) {
+    float min_a = INFINITY, max_a = -INFINITY, min_b = INFINITY, max_b = -INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float projection_a = glm_vec3_dot(a[i], axis);
+        float projection_b = glm_vec3_dot(b[i], axis);
+        min_a = fminf(min_a, projection_a);
+        max_a = fmaxf(max_a, projection_a);
+        min_b = fminf(min_b, projection_b);
+        max_b = fmaxf(max_b, projection_b);
+    }
+    return max_a < min_b || max_b < min_a;
+}
+
+// Separating axis test: both face normals and the nine edge cross products,
+// plus the in-plane edge normals when the triangles are coplanar
+bool triangles_intersect(vec3 *a, vec3 *b) {
+    vec3 edges_a[3], edges_b[3], normal_a, normal_b, axis;
+    for (int i = 0; i < 3; i++) {
+        glm_vec3_sub(a[(i+1) % 3], a[i], edges_a[i]);
+        glm_vec3_sub(b[(i+1) % 3], b[i], edges_b[i]);
+    }
+    glm_vec3_cross(edges_a[0], edges_a[1], normal_a);
+    glm_vec3_cross(edges_b[0], edges_b[1], normal_b);
+    if (separated_on(normal_a, a, b) || separated_on(normal_b, a, b))
+        return false;
+
+    bool parallel = true;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            glm_vec3_cross(edges_a[i], edges_b[j], axis);
+            if (glm_vec3_norm2(axis) < 1e-12f)
+                continue;
+            parallel = false;
+            if (separated_on(axis, a, b))
+                return false;
+        }
+    }
+
+    if (parallel) {
+        for (int i = 0; i < 3; i++) {
+            glm_vec3_cross(normal_a, edges_a[i], axis);
+            if (separated_on(axis, a, b))
+                return false;
+            glm_vec3_cross(normal_a, edges_b[i], axis);
+            if (separated_on(axis, a, b))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Shapes are star shaped around their center, so a point is inside when the
+// surface the ray from the center towards it crosses lies beyond it
+bool inside_shape(mesh_t *shape, vec3 point) {
+    if (glm_vec3_norm2(point) < 1e-12f)
+        return true;
+    for (int i = 0; i < shape->indices_length / 3; i++) {
+        float distance;
+        if (glm_ray_triangle(GLM_VEC3_ZERO, point,
+                             shape->vertices[shape->indices[i*3]],
+                             shape->vertices[shape->indices[i*3+1]],
+                             shape->vertices[shape->indices[i*3+2]],
+                             &distance))
+            return distance > 1.0f;
+    }
+    return false;
+}
+
+bool ship_hits_asteroid(ship_t *ship, vec3 location, asteroid_t *asteroid) {
+    mesh_t *shape = &(shape_bank[asteroid->shape]);
+
+    // Bounding spheres
+    float reach = ship->mesh.bounding_radius + shape->bounding_radius * asteroid->size;
+    if (glm_vec3_distance2(location, asteroid->location) > reach * reach)
+        return false;
+
+    // The ship's hull in the asteroid's space
+    mat4 model_matrix;
+    vec3 hull[SHIP_VERTICES_LENGTH], center;
+    ship_model_matrix(ship, model_matrix);
+    for (int i = 0; i < SHIP_VERTICES_LENGTH; i++) {
+        glm_mat4_mulv3(model_matrix, ship->mesh.vertices[i], 1.0f, hull[i]);
+        glm_vec3_add(hull[i], location, hull[i]);
+        to_asteroid_space(asteroid, hull[i], hull[i]);
+    }
+    to_asteroid_space(asteroid, location, center);
+
+    // Boxes around the hull's triangles, and around the hull as a whole
+    const int hull_triangles_length = SHIP_INDICES_LENGTH / 3;
+    vec3 hull_triangles[SHIP_INDICES_LENGTH / 3][3];
+    vec3 hull_min[SHIP_INDICES_LENGTH / 3], hull_max[SHIP_INDICES_LENGTH / 3];
+    vec3 ship_min = {INFINITY, INFINITY, INFINITY}, ship_max = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < hull_triangles_length; i++) {
+        for (int j = 0; j < 3; j++)
+            glm_vec3_copy(hull[ship->mesh.indices[i*3+j]], hull_triangles[i][j]);
+        triangle_bounds(hull_triangles[i][0], hull_triangles[i][1], hull_triangles[i][2], hull_min[i], hull_max[i]);
+        for (int axis = 0; axis < 3; axis++) {
+            ship_min[axis] = fminf(ship_min[axis], hull_min[i][axis]);
+            ship_max[axis] = fmaxf(ship_max[axis], hull_max[i][axis]);
+        }
+    }
+
+    for (int i = 0; i < shape->indices_length / 3; i++) {
+        vec3 triangle[3], triangle_min, triangle_max;
+        for (int j = 0; j < 3; j++)
+            glm_vec3_copy(shape->vertices[shape->indices[i*3+j]], triangle[j]);
+        triangle_bounds(triangle[0], triangle[1], triangle[2], triangle_min, triangle_max);
+        if (!bounds_overlap(triangle_min, triangle_max, ship_min, ship_max))
+            continue;
+        for (int j = 0; j < hull_triangles_length; j++)
+            if (bounds_overlap(triangle_min, triangle_max, hull_min[j], hull_max[j]) &&
+                triangles_intersect(triangle, hull_triangles[j]))
+                return true;
+    }
+
+    // No surfaces cross, but the ship may be entirely inside the rock
+    return inside_shape(shape, center);
+}
+
+// Only asteroids whose boxes overlap the ship's get the exact test. Relies
+// on collide_asteroids having run since anything last moved.
+bool ship_collides(ship_t *ship, vec3 location) {
+    float radius = ship->mesh.bounding_radius;
+    sweep_object_t query;
+    for (int axis = 0; axis < 3; axis++) {
+        query.min[axis] = location[axis] - radius;
+        query.max[axis] = location[axis] + radius;
+    }
+
+    // Anything starting further back than the widest box ends before the query
+    sweep_endpoint_t *endpoints = sweep_endpoints[0];
+    int low = 0, high = sweep_objects_length * 2;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (endpoints[middle].value < query.min[0] - sweep_widest)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (int i = low; i < sweep_objects_length * 2 && endpoints[i].value <= query.max[0]; i++) {
+        if (endpoints[i].tag & 1)
+            continue;
+        sweep_object_t *object = &sweep_objects[endpoints[i].tag >> 1];
+        if (boxes_overlap(object, &query) && ship_hits_asteroid(ship, location, object->asteroid))
+            return true;
+    }
+    return false;
+}
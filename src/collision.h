@@ -0,0 +1,13 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <cglm/cglm.h>
+#include "world.h"
+
+void collide_asteroids(world_t *);
+
+bool ship_hits_asteroid(ship_t *, vec3, asteroid_t *);
+
+bool ship_collides(ship_t *, vec3);
+
+#endif
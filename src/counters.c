@@ -0,0 +1,123 @@
+#include "counters.h"
+
+typedef struct {
+    long last;
+    long total;
+    long min;
+    long max;
+    int periods;
+} counter_stats_t;
+
+const char *counter_names[COUNTERS_LENGTH] = {
+    "ray_triangle_tests",
+    "broad_phase_rejects",
+    "asteroids_spawned",
+    "asteroids_split",
+    "bullets_alive",
+    "allocations",
+    "allocated_bytes",
+    "draw_calls",
+    "buffer_uploads",
+    "uploaded_bytes",
+};
+
+// Counters at or after this one belong to frames, the rest to ticks
+#define FIRST_FRAME_COUNTER COUNTER_DRAW_CALLS
+
+long counters[COUNTERS_LENGTH];
+counter_stats_t counter_stats[COUNTERS_LENGTH];
+int ticks_counted = 0, frames_counted = 0;
+
+void count_allocation(size_t bytes) {
+    counters[COUNTER_ALLOCATIONS]++;
+    counters[COUNTER_ALLOCATED_BYTES] += bytes;
+}
+
+void count_upload(size_t bytes) {
+    counters[COUNTER_BUFFER_UPLOADS]++;
+    counters[COUNTER_UPLOADED_BYTES] += bytes;
+}
+
+void close_period(int first, int last) {
+    for (int i = first; i < last; i++) {
+        counter_stats_t *stats = &(counter_stats[i]);
+        long value = counters[i];
+        if (stats->periods == 0 || value < stats->min)
+            stats->min = value;
+        if (stats->periods == 0 || value > stats->max)
+            stats->max = value;
+        stats->last = value;
+        stats->total += value;
+        stats->periods++;
+        counters[i] = 0;
+    }
+}
+
+void counters_end_tick() {
+    close_period(0, FIRST_FRAME_COUNTER);
+    ticks_counted++;
+}
+
+void counters_end_frame() {
+    close_period(FIRST_FRAME_COUNTER, COUNTERS_LENGTH);
+    frames_counted++;
+}
+
+long counter_last(counter_t counter) {
+    return counter_stats[counter].last;
+}
+
+long counter_total(counter_t counter) {
+    return counter_stats[counter].total;
+}
+
+double counter_average(counter_t counter) {
+    counter_stats_t *stats = &(counter_stats[counter]);
+    return stats->periods ? (double) stats->total / stats->periods : 0.0;
+}
+
+void counters_reset() {
+    for (int i = 0; i < COUNTERS_LENGTH; i++)
+        counter_stats[i] = (counter_stats_t) {0};
+    ticks_counted = frames_counted = 0;
+}
+
+void counters_report(FILE *file) {
+    fprintf(file, "%-20s %8s %12s %10s %10s %s\n", "counter", "count", "avg", "min", "max", "per");
+    for (int i = 0; i < COUNTERS_LENGTH; i++) {
+        counter_stats_t *stats = &(counter_stats[i]);
+        if (stats->periods == 0)
+            continue;
+        fprintf(file, "%-20s %8i %12.2f %10li %10li %s\n",
+                counter_names[i],
+                stats->periods,
+                counter_average(i),
+                stats->min,
+                stats->max,
+                i < FIRST_FRAME_COUNTER ? "tick" : "frame");
+    }
+}
+
+int save_counters_json(char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return 1;
+    }
+    fprintf(file, "{\n  \"ticks\": %i,\n  \"frames\": %i,\n  \"counters\": {\n", ticks_counted, frames_counted);
+    for (int i = 0; i < COUNTERS_LENGTH; i++) {
+        counter_stats_t *stats = &(counter_stats[i]);
+        fprintf(file, "    \"%s\": {\"per\": \"%s\", \"total\": %li, \"average\": %.3f, \"min\": %li, \"max\": %li, \"last\": %li}%s\n",
+                counter_names[i],
+                i < FIRST_FRAME_COUNTER ? "tick" : "frame",
+                stats->total,
+                counter_average(i),
+                stats->min,
+                stats->max,
+                stats->last,
+                i + 1 < COUNTERS_LENGTH ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    // Per simulation tick
+    COUNTER_RAY_TRIANGLE_TESTS,
+    COUNTER_BROAD_PHASE_REJECTS,
+    COUNTER_ASTEROIDS_SPAWNED,
+    COUNTER_ASTEROIDS_SPLIT,
+    COUNTER_BULLETS_ALIVE,
+    COUNTER_ALLOCATIONS,
+    COUNTER_ALLOCATED_BYTES,
+    // Per rendered frame
+    COUNTER_DRAW_CALLS,
+    COUNTER_BUFFER_UPLOADS,
+    COUNTER_UPLOADED_BYTES,
+    COUNTERS_LENGTH
+} counter_t;
+
+// Counted in the tick or frame that is still going on
+extern long counters[COUNTERS_LENGTH];
+
+static inline void counter_add(counter_t counter, long amount) {
+    counters[counter] += amount;
+}
+
+void count_allocation(size_t);
+void count_upload(size_t);
+
+// Close the current period, the tick counters or the frame counters
+void counters_end_tick();
+void counters_end_frame();
+
+// Over the periods closed since the last reset
+long counter_last(counter_t);
+long counter_total(counter_t);
+double counter_average(counter_t);
+
+void counters_reset();
+void counters_report(FILE *);
+int save_counters_json(char *);
+
+#endif
@@ -1,13 +1,69 @@
 #include "graphics.h"
+#include "counters.h"
+#include "occluders.h"
+#include "state.h"
+#include <stddef.h>
 
 unsigned int asteroid_shader_program, bullet_shader_program, dust_shader_program, crosshair_shader_program;
+unsigned int particle_update_shader_program, particle_shader_program;
+unsigned int depth_shader_program;
+unsigned int dust_analytic_shader_program;
 
 unsigned int depth_map_fbo;
 const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
 unsigned int depth_map;
 
+// Only the dust is shadowed, either from the depth map or by testing it
+// against the bounding spheres of everything between it and the sun
+bool analytic_shadows = false;
+vec3 sun_position = {100000.0f, 25000.0f, 0.0f};
+
 int screen_width, screen_height;
 
+// Framebuffer the scene ends up in, 0 is the window's
+unsigned int output_fbo = 0;
+
+// Vertex arrays of the things that are not meshes, each reading position
+// from its own buffer. Core profiles can not draw without one bound, so the
+// upscale pass gets an empty one.
+GLuint bullet_vao, bullet_vbo;
+GLuint dust_vao, dust_vbo;
+GLuint crosshair_vao, crosshair_vbo;
+GLuint empty_vao;
+
+typedef struct {
+    asteroid_t *asteroid;
+    float depth;
+    unsigned short key;
+} draw_item_t;
+
+// Asteroids in the order they are drawn, rebuilt for every view
+draw_item_t *draw_list = NULL, *draw_list_scratch = NULL;
+int draw_list_length = 0, draw_list_capacity = 0;
+
+bool sort_draws = true;
+bool depth_prepass = false;
+
+// Samples that passed the depth test in the lit asteroid pass, read a frame late
+GLuint fragment_queries[2];
+int fragment_query_frame = 0;
+
+// Dynamic resolution: the 3D scene goes into scene_fbo at a fraction of the
+// output size, is resolved into scene_texture and stretched over the output
+#define MIN_RESOLUTION_SCALE 0.5f
+#define GPU_TIMER_QUERIES 3
+bool dynamic_resolution = false;
+float target_gpu_time;
+float resolution_scale = 1.0f;
+unsigned int upscale_shader_program;
+GLuint scene_fbo, scene_color, scene_depth;
+GLuint scene_resolve_fbo, scene_texture;
+int scene_buffer_width = 0, scene_buffer_height = 0;
+
+// GPU time of the scene, read back a couple of frames late so it never stalls
+GLuint gpu_timer_queries[GPU_TIMER_QUERIES];
+int gpu_timer_frame = 0;
+
 void asteroid_model_matrix (asteroid_t* asteroid, mat4 matrix) {
     glm_mat4_identity(matrix);
     glm_translate(matrix, asteroid->location);
@@ -19,91 +75,190 @@ void bullet_model_matrix(bullet_t* bullet, mat4 matrix) {
     glm_translate(matrix, bullet->location);
 }
 
-void render_objects_with_shadow(world_t *world, mat4 view_matrix, mat4 projection_matrix) {
-    // Set some world members to local variables for easier access
-    asteroid_list_t* asteroids = world->asteroids;
-    ship_t *ship = world->ship;
-    bool running = world->running;
+// Positions relative to the mesh's bounding radius and normals, both snorm
+// 10-10-10-2. 8 bytes per vertex instead of two separate 12 byte vec3s; at
+// rock sizes a position step is under a tenth of a unit.
+typedef struct {
+    GLuint position;
+    GLuint normal;
+} packed_vertex_t;
+
+GLuint pack_snorm_2_10_10_10(vec3 value) {
+    GLuint packed = 0;
+    for (int i = 0; i < 3; i++) {
+        int component = (int) roundf(glm_clamp(value[i], -1.0f, 1.0f) * 511.0f);
+        packed |= ((GLuint) component & 0x3ff) << (10 * i);
+    }
+    return packed;
+}
 
-    GLuint vbo;
-    GLuint nbo;
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &nbo);
+void upload_mesh(mesh_t *mesh) {
+    vec3 *vertices = mesh->vertices;
+    unsigned char *indices = mesh->indices;
+    int indices_length = mesh->indices_length;
+    float scale = mesh->bounding_radius;
+
+    // Expand into flat shaded triangles, the packed copy only lives on the GPU
+    packed_vertex_t *packed = malloc(indices_length * sizeof(packed_vertex_t));
+    for (int i = 0; i < indices_length / 3; i++) {
+        vec3 normal;
+        make_normal(vertices[indices[i*3]],
+                    vertices[indices[i*3+1]],
+                    vertices[indices[i*3+2]],
+                    normal);
+        for (int j = i*3; j < i*3+3; j++) {
+            vec3 position;
+            glm_vec3_scale(vertices[indices[j]], 1.0f / scale, position);
+            packed[j].position = pack_snorm_2_10_10_10(position);
+            packed[j].normal = pack_snorm_2_10_10_10(normal);
+        }
+    }
 
-    glUseProgram(asteroid_shader_program);
+    glGenVertexArrays(1, &(mesh->vao));
+    bind_vertex_array(mesh->vao);
+    glGenBuffers(1, &(mesh->vbo));
+    bind_array_buffer(mesh->vbo);
+    glBufferData(GL_ARRAY_BUFFER, indices_length * sizeof(packed_vertex_t), packed, GL_STATIC_DRAW);
+    count_upload(indices_length * sizeof(packed_vertex_t));
+    glVertexAttribPointer(0, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(packed_vertex_t), (void *) offsetof(packed_vertex_t, position));
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(packed_vertex_t), (void *) offsetof(packed_vertex_t, normal));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    free(packed);
+}
 
-    unsigned int model_matrix_loc = glGetUniformLocation(asteroid_shader_program, "model_matrix");
-    unsigned int view_matrix_loc = glGetUniformLocation(asteroid_shader_program, "view_matrix");
-    unsigned int projection_matrix_loc = glGetUniformLocation(asteroid_shader_program, "projection_matrix");
+void bind_packed_mesh(mesh_t *mesh) {
+    if (mesh->vao == 0)
+        upload_mesh(mesh);
+    bind_vertex_array(mesh->vao);
+}
 
+void create_position_array(GLuint *vao, GLuint *vbo) {
+    glGenVertexArrays(1, vao);
+    bind_vertex_array(*vao);
+    glGenBuffers(1, vbo);
+    bind_array_buffer(*vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+}
 
-    glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix[0]);
-    glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix[0]);
+void radix_sort_draw_list() {
+    // Two stable counting passes over the 16 bit keys, ends up back in draw_list
+    for (int shift = 0; shift < 16; shift += 8) {
+        int offsets[257] = {0};
+        for (int i = 0; i < draw_list_length; i++)
+            offsets[((draw_list[i].key >> shift) & 0xff) + 1]++;
+        for (int i = 0; i < 256; i++)
+            offsets[i + 1] += offsets[i];
+        for (int i = 0; i < draw_list_length; i++)
+            draw_list_scratch[offsets[(draw_list[i].key >> shift) & 0xff]++] = draw_list[i];
+
+        draw_item_t *swap = draw_list;
+        draw_list = draw_list_scratch;
+        draw_list_scratch = swap;
+    }
+}
 
-    mat4 model_matrix;
-    glm_mat4_identity(model_matrix);
+void build_draw_list(world_t *world, mat4 view_matrix) {
+    draw_list_length = 0;
+    float min_depth = INFINITY, max_depth = -INFINITY;
+
+    asteroid_list_t *asteroids_head = world->asteroids;
+    while (asteroids_head->this != NULL) {
+        if (draw_list_length == draw_list_capacity) {
+            draw_list_capacity = draw_list_capacity ? draw_list_capacity * 2 : 64;
+            draw_list = realloc(draw_list, draw_list_capacity * sizeof(draw_item_t));
+            draw_list_scratch = realloc(draw_list_scratch, draw_list_capacity * sizeof(draw_item_t));
+        }
+
+        // View space looks down -z
+        vec3 view_location;
+        glm_mat4_mulv3(view_matrix, asteroids_head->this->location, 1.0f, view_location);
+        draw_list[draw_list_length].depth = -view_location[2];
+        draw_list[draw_list_length].asteroid = asteroids_head->this;
+        min_depth = fminf(min_depth, -view_location[2]);
+        max_depth = fmaxf(max_depth, -view_location[2]);
+
+        draw_list_length++;
+        asteroids_head = asteroids_head->next;
+    }
+
+    if (!sort_draws || draw_list_length < 2)
+        return;
+
+    // Quantize depth over the range that is actually in use
+    float scale = max_depth > min_depth ? 65535.0f / (max_depth - min_depth) : 0.0f;
+    for (int i = 0; i < draw_list_length; i++)
+        draw_list[i].key = (draw_list[i].depth - min_depth) * scale;
+    radix_sort_draw_list();
+}
+
+void render_objects_with_shadow(world_t *world, unsigned int program, mat4 view_matrix, mat4 projection_matrix) {
+    // Set some world members to local variables for easier access
+    ship_t *ship = world->ship;
+    bool running = world->running;
+
+    use_program(program);
 
-    // Rotate ship in xz-plane
-    float angle;
-    vec3 axis;
-    glm_vec3_cross(ship->pointing_direction, (vec3) {0.0f, 1.0f, 0.0f}, axis);
-    angle = glm_vec3_angle(ship->pointing_direction, (vec3) {ship->pointing_direction[0], 0.0f, ship->pointing_direction[2]});
-    if (ship->pointing_direction[1] < 0.0f)
-        angle *= -1;
-    glm_rotate(model_matrix, angle, axis);
+    unsigned int model_matrix_loc = glGetUniformLocation(program, "model_matrix");
+    unsigned int position_scale_loc = glGetUniformLocation(program, "position_scale");
+    unsigned int view_matrix_loc = glGetUniformLocation(program, "view_matrix");
+    unsigned int projection_matrix_loc = glGetUniformLocation(program, "projection_matrix");
 
-    // Rotate ship y-component
-    angle = glm_vec3_angle((vec3) {ship->pointing_direction[0], 0.0f, ship->pointing_direction[2]}, (vec3) {0.0f, 0.0f, -1.0f});
-    if (ship->pointing_direction[0] < 0.0f)
-        angle *= -1;
-    glm_rotate(model_matrix, angle, (vec3) {0.0f, -1.0f, 0.0f});
+    glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix[0]);
+    glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix[0]);
 
+    mat4 model_matrix;
+    ship_model_matrix(ship, model_matrix);
 
     if (running) {
         // Draw ship
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*18, ship->vertices, GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, nbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*18, ship->normals, GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        bind_packed_mesh(&(ship->mesh));
 
         glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, model_matrix[0]);
-        glDrawArrays(GL_TRIANGLES, 0, 18);
+        glUniform1f(position_scale_loc, ship->mesh.bounding_radius);
+        glDrawArrays(GL_TRIANGLES, 0, ship->mesh.indices_length);
+        counter_add(COUNTER_DRAW_CALLS, 1);
     }
 
-    // Draw asteroids
-    asteroid_list_t *asteroids_head = asteroids;
-    while (asteroids_head->this != NULL) {
-        asteroid_t *asteroid = asteroids_head->this;
+    // Other players' ships use the same mesh
+    if (world->peers_length > 0)
+        bind_packed_mesh(&(ship->mesh));
+    for (int i = 0; i < world->peers_length; i++) {
+        mat4 translation, peer_matrix;
+        glm_translate_make(translation, world->peers[i].location);
+        pointing_model_matrix(world->peers[i].pointing_direction, peer_matrix);
+        glm_mat4_mul(translation, peer_matrix, peer_matrix);
+
+        glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, peer_matrix[0]);
+        glUniform1f(position_scale_loc, ship->mesh.bounding_radius);
+        glDrawArrays(GL_TRIANGLES, 0, ship->mesh.indices_length);
+        counter_add(COUNTER_DRAW_CALLS, 1);
+    }
 
-        asteroid_model_matrix(asteroids_head->this, model_matrix);
+    // Draw asteroids, nearest first when sorted so that depth testing rejects
+    // the fragments of rocks behind them before they are shaded
+    for (int i = 0; i < draw_list_length; i++) {
+        asteroid_t *asteroid = draw_list[i].asteroid;
 
-        glBindBuffer(GL_ARRAY_BUFFER, asteroid->vbo);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        asteroid_model_matrix(asteroid, model_matrix);
 
-        glBindBuffer(GL_ARRAY_BUFFER, asteroid->nbo);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        mesh_t *shape = &(shape_bank[asteroid->shape]);
+        bind_packed_mesh(shape);
 
         glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, model_matrix[0]);
-        glDrawArrays(GL_TRIANGLES, 0, asteroid->vertices_length);
-
-        asteroids_head = asteroids_head->next;
+        glUniform1f(position_scale_loc, shape->bounding_radius * asteroid->size);
+        glDrawArrays(GL_TRIANGLES, 0, shape->indices_length);
+        counter_add(COUNTER_DRAW_CALLS, 1);
     }
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &nbo);
 }
 
 void get_sun_perspective(world_t *world, mat4 view_matrix, mat4 projection_matrix) {
-    vec3 eye = {100000.0, 25000.0, 0.0};
     vec3 eye_dir;
-    glm_vec3_scale(eye, -1.0f, eye_dir);
+    glm_vec3_scale(sun_position, -1.0f, eye_dir);
     glm_vec3_normalize(eye_dir);
     vec3 up = {0.0f, 1.0f, 0.0f};
-    glm_look(eye, eye_dir, up, view_matrix);
+    glm_look(sun_position, eye_dir, up, view_matrix);
 
     // Perspective matrix
     glm_perspective(3.14159265358979323f/128.0f, 1.0f, 1000.0f, 250000.0f, projection_matrix);
@@ -112,18 +267,10 @@ void get_sun_perspective(world_t *world, mat4 view_matrix, mat4 projection_matri
 void render_objects_without_shadow(world_t *world, mat4 view_matrix, mat4 projection_matrix) {
     // Set some world members to local variables for easier access
     bullet_list_t *bullets = world->bullets;
-    int score = world->score;
-    bool running = world->running;
-
-    GLuint vbo;
-    GLuint nbo;
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &nbo);
 
     // Draw bullets
-    glDisableVertexAttribArray(1);
-
-    glUseProgram(bullet_shader_program);
+    use_program(bullet_shader_program);
+    bind_vertex_array(bullet_vao);
 
     unsigned int model_matrix_loc = glGetUniformLocation(bullet_shader_program, "model_matrix");
     unsigned int view_matrix_loc = glGetUniformLocation(bullet_shader_program, "view_matrix");
@@ -140,46 +287,61 @@ void render_objects_without_shadow(world_t *world, mat4 view_matrix, mat4 projec
 
         bullet_model_matrix(bullet, model_matrix);
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        bind_array_buffer(bullet_vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*2, bullet->vertices, GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        count_upload(sizeof(vec3)*2);
 
         glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, model_matrix[0]);
         glDrawArrays(GL_LINES, 0, 2);
+        counter_add(COUNTER_DRAW_CALLS, 1);
 
         bullets_head = bullets_head->next;
     }
 
     // Draw dust
-    glUseProgram(dust_shader_program);
-    view_matrix_loc = glGetUniformLocation(dust_shader_program, "view_matrix");
-    projection_matrix_loc = glGetUniformLocation(dust_shader_program, "projection_matrix");
-    unsigned int light_matrix_loc = glGetUniformLocation(dust_shader_program, "light_matrix");
-    mat4 light_view, light_projection;
-    get_sun_perspective(world, light_view, light_projection);
-    mat4 light_matrix;
-    glm_mat4_mul(light_projection, light_view, light_matrix);
+    profiler_begin(PROFILE_DUST);
+    unsigned int dust_program = analytic_shadows ? dust_analytic_shader_program : dust_shader_program;
+    use_program(dust_program);
+    view_matrix_loc = glGetUniformLocation(dust_program, "view_matrix");
+    projection_matrix_loc = glGetUniformLocation(dust_program, "projection_matrix");
     glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix[0]);
     glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix[0]);
-    glUniformMatrix4fv(light_matrix_loc, 1, GL_FALSE, light_matrix[0]);
-    glBindTexture(GL_TEXTURE_2D, depth_map);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (!analytic_shadows) {
+        unsigned int light_matrix_loc = glGetUniformLocation(dust_program, "light_matrix");
+        mat4 light_view, light_projection;
+        get_sun_perspective(world, light_view, light_projection);
+        mat4 light_matrix;
+        glm_mat4_mul(light_projection, light_view, light_matrix);
+        glUniformMatrix4fv(light_matrix_loc, 1, GL_FALSE, light_matrix[0]);
+        bind_texture(depth_map);
+    }
+    bind_vertex_array(dust_vao);
+    bind_array_buffer(dust_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*world->dust_cloud->vertices_length, world->dust_cloud->vertices, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    count_upload(sizeof(vec3)*world->dust_cloud->vertices_length);
     glDrawArrays(GL_POINTS, 0, world->dust_cloud->vertices_length);
+    counter_add(COUNTER_DRAW_CALLS, 1);
+    profiler_end(PROFILE_DUST);
 
-    // Draw crosshair
-    glUseProgram(crosshair_shader_program);
-    vec3 crosshair_vertices[4] = {{0.025f, 0.0f, 0.0f},
-                                  {-0.025f, 0.0f, 0.0f},
-                                  {0.0f, 0.025f, 0.0f},
-                                  {0.0f, -0.025f, 0.0f}};
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*4, crosshair_vertices, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glDrawArrays(GL_LINES, 0, 4);
+    // Draw debris
+    profiler_begin(PROFILE_PARTICLES);
+    render_particles(view_matrix, projection_matrix);
+    profiler_end(PROFILE_PARTICLES);
+}
 
-    glDisableVertexAttribArray(0);
+// Crosshair and score, always drawn at the output's native resolution
+void render_hud(world_t *world) {
+    int score = world->score;
+    bool running = world->running;
+
+    // Draw crosshair, on top of whatever the scene left in the depth buffer
+    profiler_begin(PROFILE_HUD);
+    glDisable(GL_DEPTH_TEST);
+    use_program(crosshair_shader_program);
+    bind_vertex_array(crosshair_vao);
+    glDrawArrays(GL_LINES, 0, 4);
+    counter_add(COUNTER_DRAW_CALLS, 1);
+    glEnable(GL_DEPTH_TEST);
 
     // Draw score and possibly game over
     gltInit();
@@ -194,11 +356,13 @@ void render_objects_without_shadow(world_t *world, mat4 view_matrix, mat4 projec
 
     gltColor(1.0f, 1.0f, 1.0f, 1.0f);
     gltDrawText2D(text, 0, 0, 1.0f);
+    // One glDrawArrays inside glText
+    counter_add(COUNTER_DRAW_CALLS, 1);
     gltEndDraw();
     gltTerminate();
-
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &nbo);
+    // glText binds its own program, buffer, texture and vertex array
+    forget_state();
+    profiler_end(PROFILE_HUD);
 }
 
 void get_ship_perspective(world_t *world, mat4 view_matrix, mat4 projection_matrix) {
@@ -219,13 +383,13 @@ void get_ship_perspective(world_t *world, mat4 view_matrix, mat4 projection_matr
     glm_look(eye, eye_dir, up, view_matrix);
 
     // Perspective matrix
-    glm_perspective(3.14159265358979323f/2.0f, 16.0f/9.0f, 1.0f, 100000.0f, projection_matrix);
+    glm_perspective(3.14159265358979323f/2.0f, (float) screen_width / screen_height, 1.0f, 100000.0f, projection_matrix);
 }
 
 void setup_shadows() {
     glGenFramebuffers(1, &depth_map_fbo);
     glGenTextures(1, &depth_map);
-    glBindTexture(GL_TEXTURE_2D, depth_map);
+    bind_texture(depth_map);
     glTexImage2D(GL_TEXTURE_2D,
                  0,
                  GL_DEPTH_COMPONENT,
@@ -237,8 +401,10 @@ void setup_shadows() {
                  NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // Outside the sun's view nothing casts a shadow, rather than repeating it
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, (float[]) {1.0f, 1.0f, 1.0f, 1.0f});
 
     glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_map, 0);
@@ -247,27 +413,227 @@ void setup_shadows() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void render(GLFWwindow *window, world_t *world) {
+void set_render_target(unsigned int fbo, int width, int height) {
+    output_fbo = fbo;
+    screen_width = width;
+    screen_height = height;
+}
+
+void set_draw_options(bool sort, bool prepass, bool analytic) {
+    sort_draws = sort;
+    depth_prepass = prepass;
+    analytic_shadows = analytic;
+}
+
+void set_dynamic_resolution(float target_ms) {
+    dynamic_resolution = target_ms > 0.0f;
+    target_gpu_time = target_ms / 1000.0f;
+    resolution_scale = 1.0f;
+}
+
+void delete_scene_buffers() {
+    glDeleteFramebuffers(1, &scene_fbo);
+    glDeleteRenderbuffers(1, &scene_color);
+    glDeleteRenderbuffers(1, &scene_depth);
+    glDeleteFramebuffers(1, &scene_resolve_fbo);
+    glDeleteTextures(1, &scene_texture);
+    // The deleted texture may have been bound, and its name may come back
+    forget_state();
+}
+
+int create_scene_buffers(int samples) {
+    glGenFramebuffers(1, &scene_fbo);
+    glGenRenderbuffers(1, &scene_color);
+    glGenRenderbuffers(1, &scene_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, scene_color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, screen_width, screen_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, scene_depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, screen_width, screen_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, scene_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scene_depth);
+    int complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // Single sampled copy the upscale pass filters from
+    glGenFramebuffers(1, &scene_resolve_fbo);
+    glGenTextures(1, &scene_texture);
+    bind_texture(scene_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, screen_width, screen_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_resolve_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_texture, 0);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+
+    if (!complete)
+        delete_scene_buffers();
+    return complete;
+}
+
+// Buffers are allocated at full output size once, lower scales only use a
+// corner of them so changing the scale never reallocates
+int ensure_scene_buffers() {
+    if (scene_buffer_width == screen_width && scene_buffer_height == screen_height)
+        return 1;
+    if (scene_buffer_width)
+        delete_scene_buffers();
+    scene_buffer_width = screen_width;
+    scene_buffer_height = screen_height;
+    if (!create_scene_buffers(4) && !create_scene_buffers(0)) {
+        fprintf(stderr, "Dynamic resolution framebuffer incomplete, disabling it\n");
+        dynamic_resolution = false;
+        scene_buffer_width = scene_buffer_height = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void begin_gpu_timer() {
+    glBeginQuery(GL_TIME_ELAPSED, gpu_timer_queries[gpu_timer_frame % GPU_TIMER_QUERIES]);
+}
+
+void end_gpu_timer() {
+    glEndQuery(GL_TIME_ELAPSED);
+
+    // Steer by the oldest query in flight, skip the frame if it is not in yet
+    gpu_timer_frame++;
+    if (gpu_timer_frame < GPU_TIMER_QUERIES)
+        return;
+    GLuint query = gpu_timer_queries[gpu_timer_frame % GPU_TIMER_QUERIES];
+    GLuint available;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+    GLuint64 elapsed;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    // Some drivers return junk for the very first query, ignore the absurd
+    float seconds = elapsed / 1e9f;
+    if (seconds <= 0.0f || seconds > 1.0f)
+        return;
+    profiler_record(PROFILE_GPU_SCENE, seconds);
+
+    // Cost is roughly proportional to the pixel count, so the square root of
+    // the time ratio gives the scale. Only move part way to damp the noise.
+    float wanted = resolution_scale * sqrtf(target_gpu_time / seconds);
+    resolution_scale += (wanted - resolution_scale) * 0.25f;
+    resolution_scale = glm_clamp(resolution_scale, MIN_RESOLUTION_SCALE, 1.0f);
+}
+
+void upscale_scene(int scene_width, int scene_height) {
+    // Resolve the used corner of the multisampled buffer
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_resolve_fbo);
+    glBlitFramebuffer(0, 0, scene_width, scene_height,
+                      0, 0, scene_width, scene_height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    // Stretch it over the output with a single triangle. A blit cannot do
+    // this, the output may itself be multisampled.
+    glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+    glViewport(0, 0, screen_width, screen_height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_MULTISAMPLE);
+    use_program(upscale_shader_program);
+    glUniform2f(glGetUniformLocation(upscale_shader_program, "scene_size"), scene_width, scene_height);
+    bind_texture(scene_texture);
+    bind_vertex_array(empty_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    counter_add(COUNTER_DRAW_CALLS, 1);
+    glEnable(GL_MULTISAMPLE);
+    glEnable(GL_DEPTH_TEST);
+    profiler_record(PROFILE_RESOLUTION_SCALE, resolution_scale * 100.0f);
+}
+
+void begin_fragment_query() {
+    glBeginQuery(GL_SAMPLES_PASSED, fragment_queries[fragment_query_frame % 2]);
+}
+
+void end_fragment_query() {
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    // Collect last frame's count if it is in, never wait for it
+    fragment_query_frame++;
+    if (fragment_query_frame < 2)
+        return;
+    GLuint query = fragment_queries[fragment_query_frame % 2];
+    GLuint available, samples;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+        profiler_record(PROFILE_FRAGMENTS_SHADED, samples);
+    }
+}
+
+void render(world_t *world) {
     mat4 view_matrix;
     mat4 projection_matrix;
 
-    // Compute shadows
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    get_sun_perspective(world, view_matrix, projection_matrix);
-    render_objects_with_shadow(world, view_matrix, projection_matrix);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    int scene_width = screen_width;
+    int scene_height = screen_height;
+    unsigned int scene_target = output_fbo;
+    bool scaled = dynamic_resolution && ensure_scene_buffers();
+    if (scaled) {
+        scene_width = (int) ceilf(screen_width * resolution_scale);
+        scene_height = (int) ceilf(screen_height * resolution_scale);
+        scene_target = scene_fbo;
+        begin_gpu_timer();
+    }
+
+    // Compute shadows, analytic ones only need the occluders uploaded
+    profiler_begin(PROFILE_SHADOW_PASS);
+    if (analytic_shadows) {
+        vec3 sun_direction;
+        glm_vec3_normalize_to(sun_position, sun_direction);
+        update_occluders(world, sun_direction);
+    } else {
+        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        get_sun_perspective(world, view_matrix, projection_matrix);
+        build_draw_list(world, view_matrix);
+        render_objects_with_shadow(world, asteroid_shader_program, view_matrix, projection_matrix);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_target);
+    profiler_end(PROFILE_SHADOW_PASS);
 
     // Render scene
-    glViewport(0, 0, screen_width, screen_height);
+    profiler_begin(PROFILE_SCENE_PASS);
+    glViewport(0, 0, scene_width, scene_height);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     get_ship_perspective(world, view_matrix, projection_matrix);
-    glBindTexture(GL_TEXTURE_2D, depth_map);
-    render_objects_with_shadow(world, view_matrix, projection_matrix);
+    build_draw_list(world, view_matrix);
+    if (depth_prepass) {
+        // Depth only, the lit pass then shades just the visible samples
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        render_objects_with_shadow(world, depth_shader_program, view_matrix, projection_matrix);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    begin_fragment_query();
+    render_objects_with_shadow(world, asteroid_shader_program, view_matrix, projection_matrix);
+    end_fragment_query();
+    if (depth_prepass) {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+    profiler_end(PROFILE_SCENE_PASS);
     render_objects_without_shadow(world, view_matrix, projection_matrix);
 
-    glfwSwapBuffers(window);
+    if (scaled) {
+        end_gpu_timer();
+        upscale_scene(scene_width, scene_height);
+    }
+    render_hud(world);
+
+    int binds_made, binds_saved;
+    take_bind_counts(&binds_made, &binds_saved);
+    profiler_record(PROFILE_BINDS, binds_made);
+    profiler_record(PROFILE_BINDS_SAVED, binds_saved);
+    counters_end_frame();
 }
 
 unsigned int compile_shader(char *shader_path, int shader_type) {
@@ -320,6 +686,21 @@ void add_shader_program(char *vertex_shader_path,
     glLinkProgram(*shader_program_ptr);
 }
 
+void add_transform_feedback_program(char *vertex_shader_path,
+                                    const char **varyings,
+                                    int varyings_length,
+                                    unsigned int *shader_program_ptr) {
+    // Vertex shader only, its outputs are captured instead of rasterized
+    unsigned int vertex_shader = compile_shader(vertex_shader_path,
+                                                GL_VERTEX_SHADER);
+
+    // Varyings have to be declared before linking
+    *shader_program_ptr = glCreateProgram();
+    glAttachShader(*shader_program_ptr, vertex_shader);
+    glTransformFeedbackVaryings(*shader_program_ptr, varyings_length, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(*shader_program_ptr);
+}
+
 void resize_framebuffer(GLFWwindow* window, int width, int height) {
     screen_width = width;
     screen_height = height;
@@ -332,6 +713,10 @@ int intialize_window(GLFWwindow **window) {
     }
 
     glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     *window = glfwCreateWindow(1920, 1080, "Particles", NULL, NULL);
 
     if (!*window) {
@@ -342,13 +727,24 @@ int intialize_window(GLFWwindow **window) {
 
     glfwMakeContextCurrent(*window);
     glfwSetFramebufferSizeCallback(*window, resize_framebuffer);
+    glfwGetFramebufferSize(*window, &screen_width, &screen_height);
 
+    // GLEW only loads core profile functions when told to try everything,
+    // and leaves behind an error from asking for the extension string
+    glewExperimental = GL_TRUE;
     GLenum res = glewInit();
     if (res != GLEW_OK) {
         fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(res));
         return 1;
     }
+    glGetError();
+
+    initialize_renderer();
+
+    return 0;
+}
 
+void initialize_renderer() {
     glEnable(GL_MULTISAMPLE);
     glEnable(GL_DEPTH_TEST);
 
@@ -361,13 +757,41 @@ int intialize_window(GLFWwindow **window) {
     add_shader_program(DUST_VERTEX_SHADER_PATH,
                        DUST_FRAGMENT_SHADER_PATH,
                        &dust_shader_program);
+    add_shader_program(DUST_ANALYTIC_VERTEX_SHADER_PATH,
+                       DUST_FRAGMENT_SHADER_PATH,
+                       &dust_analytic_shader_program);
     add_shader_program(CROSSHAIR_VERTEX_SHADER_PATH,
                        CROSSHAIR_FRAGMENT_SHADER_PATH,
                        &crosshair_shader_program);
+    add_shader_program(DEPTH_VERTEX_SHADER_PATH,
+                       DEPTH_FRAGMENT_SHADER_PATH,
+                       &depth_shader_program);
+    add_shader_program(PARTICLE_VERTEX_SHADER_PATH,
+                       PARTICLE_FRAGMENT_SHADER_PATH,
+                       &particle_shader_program);
+    const char *particle_varyings[] = {"next_position_life", "next_velocity_lifetime"};
+    add_shader_program(UPSCALE_VERTEX_SHADER_PATH,
+                       UPSCALE_FRAGMENT_SHADER_PATH,
+                       &upscale_shader_program);
+    add_transform_feedback_program(PARTICLE_UPDATE_VERTEX_SHADER_PATH,
+                                   particle_varyings,
+                                   2,
+                                   &particle_update_shader_program);
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
     setup_shadows();
-
-    return 0;
+    create_position_array(&bullet_vao, &bullet_vbo);
+    create_position_array(&dust_vao, &dust_vbo);
+    create_position_array(&crosshair_vao, &crosshair_vbo);
+    vec3 crosshair_vertices[4] = {{0.025f, 0.0f, 0.0f},
+                                  {-0.025f, 0.0f, 0.0f},
+                                  {0.0f, 0.025f, 0.0f},
+                                  {0.0f, -0.025f, 0.0f}};
+    glBufferData(GL_ARRAY_BUFFER, sizeof(crosshair_vertices), crosshair_vertices, GL_STATIC_DRAW);
+    glGenVertexArrays(1, &empty_vao);
+    glGenQueries(2, fragment_queries);
+    glGenQueries(GPU_TIMER_QUERIES, gpu_timer_queries);
+    initialize_particles(particle_update_shader_program, particle_shader_program);
+    initialize_occluders(dust_analytic_shader_program);
 }
@@ -7,8 +7,16 @@
 #define BULLET_FRAGMENT_SHADER_PATH "src/shaders/bullet_fragments.glsl"
 #define DUST_VERTEX_SHADER_PATH "src/shaders/dust_vertices.glsl"
 #define DUST_FRAGMENT_SHADER_PATH "src/shaders/dust_fragments.glsl"
+#define DUST_ANALYTIC_VERTEX_SHADER_PATH "src/shaders/dust_analytic_vertices.glsl"
 #define CROSSHAIR_VERTEX_SHADER_PATH "src/shaders/crosshair_vertices.glsl"
 #define CROSSHAIR_FRAGMENT_SHADER_PATH "src/shaders/crosshair_fragments.glsl"
+#define DEPTH_VERTEX_SHADER_PATH "src/shaders/depth_vertices.glsl"
+#define DEPTH_FRAGMENT_SHADER_PATH "src/shaders/depth_fragments.glsl"
+#define PARTICLE_UPDATE_VERTEX_SHADER_PATH "src/shaders/particle_update_vertices.glsl"
+#define PARTICLE_VERTEX_SHADER_PATH "src/shaders/particle_vertices.glsl"
+#define PARTICLE_FRAGMENT_SHADER_PATH "src/shaders/particle_fragments.glsl"
+#define UPSCALE_VERTEX_SHADER_PATH "src/shaders/upscale_vertices.glsl"
+#define UPSCALE_FRAGMENT_SHADER_PATH "src/shaders/upscale_fragments.glsl"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -16,12 +24,22 @@
 #include <stdio.h>
 #include <math.h>
 #include "world.h"
+#include "particles.h"
+#include "profiler.h"
 
 #include "gltext/gltext.h"
 
 int intialize_window(GLFWwindow **);
 
-void render (GLFWwindow *, world_t *);
+void initialize_renderer();
+
+void set_render_target(unsigned int, int, int);
+
+void set_draw_options(bool, bool, bool);
+
+void set_dynamic_resolution(float);
+
+void render (world_t *);
 
 void asteroid_translation_matrix(asteroid_t*, mat4);
 
@@ -0,0 +1,142 @@
+#include "headless.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+EGLDisplay headless_display;
+EGLContext headless_context;
+
+// Multisampled target the scene is rendered into, resolved for dumping
+GLuint headless_fbo, headless_color, headless_depth;
+GLuint resolve_fbo, resolve_color;
+int headless_width, headless_height;
+
+EGLDisplay get_surfaceless_display() {
+    // Prefer Mesa's surfaceless platform, it needs no display server or GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+        EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int create_headless_framebuffer(int samples) {
+    glGenFramebuffers(1, &headless_fbo);
+    glGenRenderbuffers(1, &headless_color);
+    glGenRenderbuffers(1, &headless_depth);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, headless_width, headless_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, headless_width, headless_height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headless_depth);
+    int complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!complete) {
+        glDeleteFramebuffers(1, &headless_fbo);
+        glDeleteRenderbuffers(1, &headless_color);
+        glDeleteRenderbuffers(1, &headless_depth);
+    }
+    return complete;
+}
+
+int initialize_headless(int width, int height, unsigned int *fbo) {
+    headless_width = width;
+    headless_height = height;
+
+    headless_display = get_surfaceless_display();
+    if (headless_display == EGL_NO_DISPLAY || !eglInitialize(headless_display, NULL, NULL)) {
+        fprintf(stderr, "EGL failed to init\n");
+        return 1;
+    }
+
+    // No surface is ever created, but the default window bit matches nothing
+    EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                                  EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                  EGL_NONE};
+    EGLConfig config;
+    EGLint configs_length;
+    if (!eglChooseConfig(headless_display, config_attributes, &config, 1, &configs_length) || configs_length < 1) {
+        fprintf(stderr, "No EGL config supports desktop OpenGL\n");
+        return 1;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3,
+                                   EGL_CONTEXT_MINOR_VERSION, 3,
+                                   EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                   EGL_NONE};
+    headless_context = eglCreateContext(headless_display, config, EGL_NO_CONTEXT, context_attributes);
+    if (headless_context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "EGL context failed to create\n");
+        return 1;
+    }
+
+    // Surfaceless: there is no default framebuffer, everything goes to FBOs
+    if (!eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless_context)) {
+        fprintf(stderr, "EGL context could not be made current\n");
+        return 1;
+    }
+
+    // GLEW looks for GLX after loading the entry points, which fails without
+    // an X display but leaves the GL functions usable.
+    glewExperimental = GL_TRUE;
+    GLenum res = glewInit();
+    if (res != GLEW_OK && res != GLEW_ERROR_NO_GLX_DISPLAY) {
+        fprintf(stderr, "Error initializing GLEW: %s\n", glewGetErrorString(res));
+        return 1;
+    }
+
+    // Same 4x MSAA as the window, unless the driver can not do it
+    if (!create_headless_framebuffer(4) && !create_headless_framebuffer(0)) {
+        fprintf(stderr, "Offscreen framebuffer failed to create\n");
+        return 1;
+    }
+
+    glGenFramebuffers(1, &resolve_fbo);
+    glGenRenderbuffers(1, &resolve_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, resolve_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolve_color);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+
+    *fbo = headless_fbo;
+    return 0;
+}
+
+void dump_frame(char *path) {
+    // Resolve multisampling, then read back
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, headless_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo);
+    glBlitFramebuffer(0, 0, headless_width, headless_height,
+                      0, 0, headless_width, headless_height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo);
+
+    unsigned char *pixels = malloc(3 * headless_width * headless_height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, headless_width, headless_height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+
+    FILE *file = fopen(path, "wb");
+    if (file) {
+        // Binary PPM, rows flipped since GL reads bottom-up
+        fprintf(file, "P6\n%i %i\n255\n", headless_width, headless_height);
+        for (int y = headless_height - 1; y >= 0; y--)
+            fwrite(pixels + 3 * headless_width * y, 1, 3 * headless_width, file);
+        fclose(file);
+    } else {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+    }
+
+    free(pixels);
+}
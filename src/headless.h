@@ -0,0 +1,10 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+
+int initialize_headless(int, int, unsigned int *);
+
+void dump_frame(char *);
+
+#endif
@@ -1,15 +1,64 @@
+#include "client.h"
+#include "collision.h"
+#include "counters.h"
 #include "graphics.h"
+#include "headless.h"
+#include "pacing.h"
+#include "particles.h"
+#include "profiler.h"
+#include "sectors.h"
+#include "server.h"
+#include "snapshot.h"
 #include "world.h"
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-#define ASTEROID_SIZE 24.0f
-#define ASTEROID_VARIATION 12.0f
 #define MINIMUM_COLLISION_DISTANCE 36.0f
 
+typedef struct {
+    bool headless;
+    bool profile;
+    int width;
+    int height;
+    int frames;
+    int dump_every;
+    char *dump_prefix;
+    unsigned int seed;
+    bool seed_given;
+    pacing_mode_t pacing_mode;
+    double fps;
+    int frames_in_flight;
+    char *load_snapshot_path;
+    char *save_snapshot_path;
+    int checkpoint_every;
+    bool sort_draws;
+    bool depth_prepass;
+    bool analytic_shadows;
+    float target_gpu_ms;
+    int asteroids;
+    int server_port;
+    char *connect_address;
+    int net_clients;
+    bool sectors;
+    int sector_cache_kb;
+    char *counters_json_path;
+} options_t;
+
 GLFWwindow *window;
 world_t *world;
 
+// Set when playing on a server, input then goes there
+client_t *client;
+
+volatile sig_atomic_t server_stopping = 0;
+
+// The world as it was right after starting, restored by restarting
+void *restart_snapshot;
+size_t restart_snapshot_size;
+
 void move_objects(float delta){
     // Handle rotations
     asteroid_list_t *asteroids_head = world->asteroids;
@@ -45,7 +94,7 @@ void move_objects(float delta){
         glm_vec3_scale(asteroids_head->this->direction, delta*asteroids_head->this->speed, diff);
         glm_vec3_add(asteroids_head->this->location, diff, asteroids_head->this->location);
         glm_vec3_add(asteroids_head->this->location, ship_diff, asteroids_head->this->location);
-        if (glm_vec3_norm(asteroids_head->this->location) > max_distance) {
+        if (!sectors_enabled && glm_vec3_norm(asteroids_head->this->location) > max_distance) {
             glm_vec3_negate(asteroids_head->this->location);
         }
 
@@ -55,7 +104,7 @@ void move_objects(float delta){
     // Move dust
     for (int i = 0; i < world->dust_cloud->vertices_length; i++){
         glm_vec3_add(world->dust_cloud->vertices[i], ship_diff, world->dust_cloud->vertices[i]);
-        if (glm_vec3_norm(world->dust_cloud->vertices[i]) > max_distance) {
+        if (!sectors_enabled && glm_vec3_norm(world->dust_cloud->vertices[i]) > max_distance) {
             glm_vec3_negate(world->dust_cloud->vertices[i]);
         }
     }
@@ -64,20 +113,23 @@ void move_objects(float delta){
 void process_collisions(float delta) {
     // Asteroid-bullet intersections
     // Iterate over asteroids
+    // Counted locally, this is the innermost loop of the update
+    long ray_triangle_tests = 0, broad_phase_rejects = 0;
     asteroid_list_t *asteroids_head = world->asteroids;
     asteroid_list_t **asteroids_link = &(world->asteroids);
     while(asteroids_head->next != NULL) {
         asteroid_t *asteroid = asteroids_head->this;
+        mesh_t *shape = &(shape_bank[asteroid->shape]);
         int asteroid_destroyed = 0;
 
         // Iterate over the asteroid's triangles
-        for (int i = 0; i < asteroid->vertices_length / 3; i++) {
+        for (int i = 0; i < shape->indices_length / 3; i++) {
             vec3 origin, direction, v0, v1, v2;
 
             // Set v0,v1,v2 to triangle vertices in world space
-            glm_vec3_copy(asteroid->vertices[i*3], v0);
-            glm_vec3_copy(asteroid->vertices[i*3+1], v1);
-            glm_vec3_copy(asteroid->vertices[i*3+2], v2);
+            glm_vec3_scale(shape->vertices[shape->indices[i*3]], asteroid->size, v0);
+            glm_vec3_scale(shape->vertices[shape->indices[i*3+1]], asteroid->size, v1);
+            glm_vec3_scale(shape->vertices[shape->indices[i*3+2]], asteroid->size, v2);
 
             glm_vec3_rotate(v0, asteroid->angle, asteroid->axis);
             glm_vec3_rotate(v1, asteroid->angle, asteroid->axis);
@@ -100,10 +152,13 @@ void process_collisions(float delta) {
                 bool intersection;
 
                 // Simple but inexact check for collision, only false positives
-                if (glm_vec3_distance(asteroid->location, bullet->location) > (bullet->speed + asteroid->speed)*delta + MINIMUM_COLLISION_DISTANCE*asteroid->size)
+                if (glm_vec3_distance(asteroid->location, bullet->location) > (bullet->speed + asteroid->speed)*delta + MINIMUM_COLLISION_DISTANCE*asteroid->size) {
                     intersection = false;
-                else
+                    broad_phase_rejects++;
+                } else {
                     intersection = glm_ray_triangle(origin, direction, v0, v1, v2, &distance);
+                    ray_triangle_tests++;
+                }
 
                 // Exact collision check
                 if (intersection && distance <= glm_vec3_distance(bullet->vertices[0], bullet->vertices[1]) + bullet->speed*delta) {
@@ -111,32 +166,34 @@ void process_collisions(float delta) {
                     *asteroids_link = asteroids_head->next;
                     asteroid_destroyed = 1;
                     *bullets_link = bullets_head->next;
-                    i = asteroid->vertices_length;
+                    i = shape->indices_length;
+
+                    // Leave a cloud of debris where the asteroid was hit
+                    vec3 velocity;
+                    glm_vec3_scale(asteroid->direction, asteroid->speed, velocity);
+                    add_debris_burst(world, asteroid->location, velocity, asteroid->size);
 
                     // If asteroid was big enough, split it into two
                     float size = asteroid->size;
                     if (size > 0.24f){
+                        counter_add(COUNTER_ASTEROIDS_SPLIT, 1);
                         world->score++;
                         size /= 2.0f;
-                        asteroid_t *asteroid1 = create_asteroid(asteroid->location, ASTEROID_SIZE*size, ASTEROID_VARIATION*size);
-                        asteroid_t *asteroid2 = create_asteroid(asteroid->location, ASTEROID_SIZE*size, ASTEROID_VARIATION*size);
-                        asteroid1->size = size;
-                        asteroid2->size = size;
+                        asteroid_t *asteroid1 = create_asteroid(asteroid->location, size);
+                        asteroid_t *asteroid2 = create_asteroid(asteroid->location, size);
                         world->asteroids = asteroid_list_cons(asteroid1, world->asteroids);
                         world->asteroids = asteroid_list_cons(asteroid2, world->asteroids);
                         glm_vec3_ortho(bullet->direction, asteroid1->direction);
                         glm_vec3_copy(asteroid1->direction, asteroid2->direction);
                         glm_vec3_negate(asteroid2->direction);
 
-                        float longitude = rand() / (float) RAND_MAX * 3.14159 * 2;
-                        float colatitude = rand() / (float) RAND_MAX * 3.14159;
-                        float distance = rand() / (float) RAND_MAX * (max_distance - 1000.0f) + 1000.0f;
+                        float longitude = random_float() * 3.14159 * 2;
+                        float colatitude = random_float() * 3.14159;
+                        float distance = random_float() * (max_distance - 1000.0f) + 1000.0f;
                         vec3 spawn_location = { distance * cos(longitude) * sin(colatitude),
                                                 distance * sin(longitude) * sin(colatitude),
                                                 distance * cos(colatitude) };
-                        world->asteroids = asteroid_list_cons(create_asteroid(spawn_location,
-                                                                              ASTEROID_SIZE,
-                                                                              ASTEROID_VARIATION),
+                        world->asteroids = asteroid_list_cons(create_asteroid(spawn_location, 1.0f),
                                                               world->asteroids);
                         world->asteroids->this->speed += sqrt((float) world->score)*250;
                     }
@@ -150,104 +207,581 @@ void process_collisions(float delta) {
             asteroids_link = &(asteroids_head->next);
         asteroids_head = asteroids_head->next;
     }
+    counter_add(COUNTER_RAY_TRIANGLE_TESTS, ray_triangle_tests);
+    counter_add(COUNTER_BROAD_PHASE_REJECTS, broad_phase_rejects);
+}
 
-    // Simple but inaccurate asteroid-ship collision check
-    asteroids_head = world->asteroids;
-    while(asteroids_head->next != NULL) {
-        asteroid_t *asteroid = asteroids_head->this;
-        if(glm_vec3_norm(asteroid->location) < MINIMUM_COLLISION_DISTANCE*asteroid->size) {
-            world->running = false;
-            glm_vec3_copy(GLM_VEC3_ZERO, world->ship->movement_direction);
-        }
-        asteroids_head = asteroids_head->next;
+void process_ship_collisions() {
+    // Exact hull against mesh test, for the rocks the broad-phase lets through
+    if (ship_collides(world->ship, GLM_VEC3_ZERO)) {
+        world->running = false;
+        glm_vec3_copy(GLM_VEC3_ZERO, world->ship->movement_direction);
     }
 }
 
+void fire_bullet() {
+    bullet_t *bullet = create_bullet((vec3) {0.0f, 0.0f, 0.0f}, world->ship->pointing_direction, 700.0+glm_vec3_norm(world->ship->movement_direction));
+    world->bullets = bullet_list_cons(bullet, world->bullets);
+}
+
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+    if (client) {
+        if (key == GLFW_KEY_T && action == GLFW_PRESS)
+            client->input.fire_count++;
+        if (key == GLFW_KEY_R && action == GLFW_PRESS)
+            client->input.respawn = true;
+        return;
+    }
     if (key == GLFW_KEY_T && action == GLFW_PRESS){
-        bullet_t *bullet = create_bullet((vec3) {0.0f, 0.0f, 0.0f}, world->ship->pointing_direction, 700.0+glm_vec3_norm(world->ship->movement_direction));
-        world->bullets = bullet_list_cons(bullet, world->bullets);
+        fire_bullet();
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS){
+        read_snapshot(world, restart_snapshot, restart_snapshot_size);
+    }
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS){
+        save_snapshot(world, SNAPSHOT_PATH);
+    }
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS){
+        load_snapshot(world, SNAPSHOT_PATH);
     }
 }
 
-int main(int argc, char *argv[]) {
-    // Initialize window
-    int error = intialize_window(&window);
-    if (error)
-        return error;
-    glfwSetKeyCallback(window, key_callback);
-
-    // Create world
-    srand(time(0));
-    world = create_world();
-
-    // Generate asteroids
-    for (int i = 0; i < 20; i++) {
+void spawn_asteroids(int count) {
+    for (int i = 0; i < count; i++) {
         // Generate random longitude, colatitude, distance not too close to ship
-        float longitude = rand() / (float) RAND_MAX * 3.14159 * 2;
-        float colatitude = rand() / (float) RAND_MAX * 3.14159;
-        float distance = sqrt(rand() / (float) RAND_MAX) * (max_distance - 750.0f) + 250.0f;
+        float longitude = random_float() * 3.14159 * 2;
+        float colatitude = random_float() * 3.14159;
+        float distance = sqrt(random_float()) * (max_distance - 750.0f) + 250.0f;
         vec3 spawn_location = { distance * cos(longitude) * sin(colatitude),
                                 distance * sin(longitude) * sin(colatitude),
                                 distance * cos(colatitude) };
 
         // Generate asteroid and add to world
-        asteroid_t *asteroid = create_asteroid(spawn_location,
-                                               ASTEROID_SIZE,
-                                               ASTEROID_VARIATION);
+        asteroid_t *asteroid = create_asteroid(spawn_location, 1.0f);
         world->asteroids = asteroid_list_cons(asteroid, world->asteroids);
     }
+}
+
+// The part of the update that needs neither GL nor the player, which is also
+// what the server runs
+void simulate_world(float delta) {
+    move_objects(delta);
+    process_collisions(delta);
+    profiler_begin(PROFILE_ROCK_COLLISIONS);
+    collide_asteroids(world);
+    profiler_end(PROFILE_ROCK_COLLISIONS);
+
+    bullet_list_t *bullets_head = world->bullets;
+    while (bullets_head->next != NULL) {
+        counter_add(COUNTER_BULLETS_ALIVE, 1);
+        bullets_head = bullets_head->next;
+    }
+}
+
+void update_world(float delta) {
+    profiler_begin(PROFILE_UPDATE);
+    simulate_world(delta);
+    if (sectors_enabled) {
+        profiler_begin(PROFILE_SECTORS);
+        update_sectors(world, delta);
+        profiler_end(PROFILE_SECTORS);
+    }
+    process_ship_collisions();
+    update_particles(world, delta);
+    glm_vec3_scale(world->ship->movement_direction, powf(0.75f, delta), world->ship->movement_direction);
+    profiler_end(PROFILE_UPDATE);
+    // The tick started after the last one closed, so bullets fired by input
+    // before it and sectors filled in after the simulation both count here
+    counters_end_tick();
+}
+
+void handle_input(float delta) {
+    if (!world->running)
+        return;
+
+    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
+        vec3 speed_diff;
+        glm_vec3_scale(world->ship->pointing_direction, delta * 120.0f, speed_diff);
+        glm_vec3_add(world->ship->movement_direction, speed_diff, world->ship->movement_direction);
+    }
+    if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS) {
+        vec3 speed_diff;
+        glm_vec3_scale(world->ship->pointing_direction, -delta * 120.0f, speed_diff);
+        glm_vec3_add(world->ship->movement_direction, speed_diff, world->ship->movement_direction);
+    }
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+        glm_vec3_rotate(world->ship->pointing_direction, -delta, (vec3) {0.0f, 1.0f, 0.0f});
+    }
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+        glm_vec3_rotate(world->ship->pointing_direction, delta, (vec3) {0.0f, 1.0f, 0.0f});
+    }
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+        vec3 axis;
+        glm_vec3_cross((vec3) {0.0f, 1.0f, 0.0f}, world->ship->pointing_direction, axis);
+        glm_vec3_rotate(world->ship->pointing_direction, -delta, axis);
+    }
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+        vec3 axis;
+        glm_vec3_cross((vec3) {0.0f, 1.0f, 0.0f}, world->ship->pointing_direction, axis);
+        glm_vec3_rotate(world->ship->pointing_direction, delta, axis);
+    }
+}
+
+bool multiplayer(options_t *options) {
+    return options->net_clients > 0 || options->server_port >= 0 || options->connect_address;
+}
+
+// A loaded snapshot decides whether sectors are used and their seed
+void start_world(options_t *options) {
+    world = create_world();
+    if (options->sectors)
+        enable_sectors((size_t) options->sector_cache_kb * 1024, options->seed);
+    if (options->load_snapshot_path) {
+        if (load_snapshot(world, options->load_snapshot_path) == 0) {
+            if (!sectors_enabled || !multiplayer(options))
+                return;
+            fprintf(stderr, "Snapshot uses sectors, which only work in single player\n");
+            disable_sectors();
+            world = create_world();
+            seed_random(options->seed);
+        }
+        fprintf(stderr, "Starting a new game instead\n");
+    }
+    if (sectors_enabled)
+        start_sectors(world);
+    else
+        spawn_asteroids(options->asteroids);
+}
+
+int run_window(options_t *options) {
+    // Initialize window
+    int error = intialize_window(&window);
+    if (error)
+        return error;
+    glfwSetKeyCallback(window, key_callback);
+    set_draw_options(options->sort_draws, options->depth_prepass, options->analytic_shadows);
+    set_dynamic_resolution(options->target_gpu_ms);
+    initialize_pacing(options->pacing_mode, options->fps, options->frames_in_flight);
+
+    // Create world, remembering how it started for instant restarts
+    start_world(options);
+    restart_snapshot_size = snapshot_size(world);
+    restart_snapshot = malloc(restart_snapshot_size);
+    write_snapshot(world, restart_snapshot);
 
     double new_time = 0.0d;
     double last_time = glfwGetTime();
     double delta = 0.0d;
 
     while(!glfwWindowShouldClose(window)) {
+        // Sample input as late as possible, right before it is simulated
+        pacing_wait();
+        glfwPollEvents();
+        pacing_input_sampled();
+
         // Get delta
         new_time = glfwGetTime();
         delta = new_time - last_time;
         last_time = new_time;
 
-        // Update world
-        move_objects(delta);
-        process_collisions(delta);
-        glm_vec3_scale(world->ship->movement_direction, powf(0.75f, delta), world->ship->movement_direction);
+        profiler_begin(PROFILE_FRAME);
+        handle_input(delta);
+        update_world(delta);
+        render(world);
+        profiler_end(PROFILE_FRAME);
+
+        glfwSwapBuffers(window);
+        pacing_frame_submitted();
+    }
+
+    if (options->profile) {
+        profiler_report(stdout);
+        counters_report(stdout);
+        if (sectors_enabled)
+            sectors_report(stdout);
+    }
+
+    return 0;
+}
+
+int run_headless(options_t *options) {
+    unsigned int fbo;
+    int error = initialize_headless(options->width, options->height, &fbo);
+    if (error)
+        return error;
+    initialize_renderer();
+    set_render_target(fbo, options->width, options->height);
+    set_draw_options(options->sort_draws, options->depth_prepass, options->analytic_shadows);
+    set_dynamic_resolution(options->target_gpu_ms);
+
+    start_world(options);
 
-        // Handle keyboard input
+    // Every frame waits for the GPU so pass and frame times are real
+    profiler_synchronous = true;
+
+    // Fixed timestep and scripted flying keep runs with the same seed identical
+    float delta = 1.0f / 60.0f;
+    for (int frame = 0; frame < options->frames; frame++) {
+        profiler_begin(PROFILE_FRAME);
         if (world->running) {
-            if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
-                vec3 speed_diff;
-                glm_vec3_scale(world->ship->pointing_direction, delta * 120.0f, speed_diff);
-                glm_vec3_add(world->ship->movement_direction, speed_diff, world->ship->movement_direction);
-            }
-            if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS) {
-                vec3 speed_diff;
-                glm_vec3_scale(world->ship->pointing_direction, -delta * 120.0f, speed_diff);
-                glm_vec3_add(world->ship->movement_direction, speed_diff, world->ship->movement_direction);
+            glm_vec3_rotate(world->ship->pointing_direction, delta * 0.3f, (vec3) {0.0f, 1.0f, 0.0f});
+            if (frame % 30 == 0)
+                fire_bullet();
+            // Cruise through the sectors, in circles so some are revisited
+            if (sectors_enabled)
+                glm_vec3_scale(world->ship->pointing_direction, 300.0f, world->ship->movement_direction);
+        }
+        update_world(delta);
+        render(world);
+        profiler_end(PROFILE_FRAME);
+
+        if (options->dump_every > 0 && frame % options->dump_every == 0) {
+            char path[256];
+            snprintf(path, sizeof(path), "%s%05i.ppm", options->dump_prefix, frame);
+            dump_frame(path);
+        }
+
+        // Checkpoints overwrite each other, a long run can be resumed from the last
+        if (options->save_snapshot_path && options->checkpoint_every > 0 && (frame + 1) % options->checkpoint_every == 0)
+            save_snapshot(world, options->save_snapshot_path);
+    }
+
+    if (options->save_snapshot_path)
+        save_snapshot(world, options->save_snapshot_path);
+
+    printf("%i frames at %ix%i\n", options->frames, options->width, options->height);
+    profiler_report(stdout);
+    counters_report(stdout);
+    if (sectors_enabled)
+        sectors_report(stdout);
+
+    return 0;
+}
+
+void stop_server(int signal) {
+    server_stopping = 1;
+}
+
+int run_server(options_t *options) {
+    server_t *server = malloc(sizeof(server_t));
+    if (start_server(server, options->server_port))
+        return 1;
+    start_world(options);
+    // Dust is only scenery, clients have their own
+    world->dust_cloud->vertices_length = 0;
+
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    printf("Serving on port %i at %i Hz\n", server->port, NET_TICK_RATE);
+    fflush(stdout);
+
+    double next_tick = profiler_time();
+    double last_report = next_tick;
+    while (!server_stopping) {
+        server_tick(server, world, simulate_world);
+        next_tick += 1.0 / NET_TICK_RATE;
+
+        double now = profiler_time();
+        if (now - last_report >= 5.0) {
+            server_report(server, stdout, now - last_report);
+            fflush(stdout);
+            server_reset_stats(server);
+            last_report = now;
+        }
+        // Do not try to catch up after a stall, just start over from now
+        if (next_tick > now)
+            usleep((next_tick - now) * 1e6);
+        else if (now - next_tick > 1.0)
+            next_tick = now;
+    }
+
+    if (options->save_snapshot_path)
+        save_snapshot(world, options->save_snapshot_path);
+    return 0;
+}
+
+int run_client(options_t *options) {
+    char host[256];
+    int port;
+    char *colon = strrchr(options->connect_address, ':');
+    if (!colon || colon - options->connect_address >= (long) sizeof(host) || sscanf(colon + 1, "%i", &port) != 1) {
+        fprintf(stderr, "Server address should look like localhost:7777\n");
+        return 1;
+    }
+    snprintf(host, colon - options->connect_address + 1, "%s", options->connect_address);
+
+    client = malloc(sizeof(client_t));
+    if (connect_client(client, host, port))
+        return 1;
+
+    int error = intialize_window(&window);
+    if (error)
+        return error;
+    glfwSetKeyCallback(window, key_callback);
+    set_draw_options(options->sort_draws, options->depth_prepass, options->analytic_shadows);
+    set_dynamic_resolution(options->target_gpu_ms);
+    initialize_pacing(options->pacing_mode, options->fps, options->frames_in_flight);
+
+    world = create_world();
+
+    double new_time = 0.0d;
+    double last_time = glfwGetTime();
+    double last_sent = 0.0d;
+    unsigned int fire_count_sent = 0;
+
+    while(!glfwWindowShouldClose(window)) {
+        pacing_wait();
+        glfwPollEvents();
+        pacing_input_sampled();
+
+        new_time = glfwGetTime();
+        float delta = new_time - last_time;
+        last_time = new_time;
+
+        profiler_begin(PROFILE_FRAME);
+        // Aiming is local, thrust and shots go to the server
+        handle_input(delta);
+        int thrust = (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+            - (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS);
+
+        // Inputs go out with every ack and every shot, and a few times a
+        // second while waiting to be let in
+        int received = client_receive(client, new_time);
+        if (received > 0 || client->input.fire_count != fire_count_sent || new_time - last_sent > 0.25) {
+            client_send_input(client, world->ship, thrust);
+            fire_count_sent = client->input.fire_count;
+            last_sent = new_time;
+        }
+
+        client_build_world(client, world, new_time);
+        update_particles(world, delta);
+        render(world);
+        profiler_end(PROFILE_FRAME);
+
+        glfwSwapBuffers(window);
+        pacing_frame_submitted();
+    }
+
+    if (options->profile)
+        profiler_report(stdout);
+
+    return 0;
+}
+
+// Server and clients in one process over loopback, stepped as fast as
+// possible with scripted clients, to measure traffic and tick times and check
+// that clients end up with the server's world
+int run_net_bench(options_t *options) {
+    server_t *server = malloc(sizeof(server_t));
+    if (start_server(server, 0))
+        return 1;
+    start_world(options);
+    world->dust_cloud->vertices_length = 0;
+
+    int clients_length = options->net_clients < NET_MAX_CLIENTS ? options->net_clients : NET_MAX_CLIENTS;
+    client_t *clients = malloc(clients_length * sizeof(client_t));
+    ship_t **ships = malloc(clients_length * sizeof(ship_t *));
+    for (int i = 0; i < clients_length; i++) {
+        if (connect_client(&clients[i], "127.0.0.1", server->port))
+            return 1;
+        ships[i] = create_ship((vec3) {0.0f, 0.0f, -1.0f});
+        glm_vec3_rotate(ships[i]->pointing_direction, i * 2.0f * GLM_PIf / clients_length, (vec3) {0.0f, 1.0f, 0.0f});
+    }
+
+    printf("%i clients, %i ticks at %i Hz over loopback\n", clients_length, options->frames, NET_TICK_RATE);
+    for (int tick = 0; tick < options->frames; tick++) {
+        double now = (double) tick / NET_TICK_RATE;
+        for (int i = 0; i < clients_length; i++) {
+            glm_vec3_rotate(ships[i]->pointing_direction, 0.3f / NET_TICK_RATE, (vec3) {0.0f, 1.0f, 0.0f});
+            int thrust = (tick / 90 + i) % 3 == 0;
+            if ((tick + i) % 15 == 0)
+                clients[i].input.fire_count++;
+            clients[i].input.respawn = true;
+            client_send_input(&clients[i], ships[i], thrust);
+        }
+        server_tick(server, world, simulate_world);
+        for (int i = 0; i < clients_length; i++)
+            client_receive(&clients[i], now);
+
+        // Joining sends everything once, report it apart from the steady state
+        double seconds = (tick + 1.0) / NET_TICK_RATE;
+        if (tick + 1 == NET_TICK_RATE || (tick + 1 == options->frames && seconds < 1.0)) {
+            printf("first second:\n");
+            server_report(server, stdout, seconds);
+            server_reset_stats(server);
+        } else if (tick + 1 == options->frames) {
+            printf("after that:\n");
+            server_report(server, stdout, seconds - 1.0);
+        }
+    }
+
+    // What clients reconstruct for the last tick against the real world
+    double error_total = 0.0, error_max = 0.0, angle_error_max = 0.0;
+    int compared = 0, missing = 0;
+    for (int i = 0; i < clients_length; i++) {
+        net_snapshot_t *snapshot = client_latest_snapshot(&clients[i]);
+        if (!snapshot || snapshot->tick != server->tick) {
+            missing++;
+            continue;
+        }
+        for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next) {
+            net_entity_t *entity = net_find_entity(snapshot->asteroids, snapshot->asteroids_length, head->this->id);
+            if (!entity) {
+                missing++;
+                continue;
             }
-            if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-                glm_vec3_rotate(world->ship->pointing_direction, -delta, (vec3) {0.0f, 1.0f, 0.0f});
+            vec3 location;
+            float angle;
+            net_reckon_smooth(entity, snapshot->tick, location, &angle);
+            double error = glm_vec3_distance(location, head->this->location);
+            error_total += error;
+            error_max = fmax(error_max, error);
+            double turn = fmod(angle - head->this->angle, 2.0 * GLM_PI);
+            turn = fabs(turn - 2.0 * GLM_PI * round(turn / (2.0 * GLM_PI)));
+            angle_error_max = fmax(angle_error_max, turn * 180.0 / GLM_PI);
+            compared++;
+        }
+        for (bullet_list_t *head = world->bullets; head->next != NULL; head = head->next) {
+            net_entity_t *entity = net_find_entity(snapshot->bullets, snapshot->bullets_length, head->this->id);
+            if (!entity) {
+                missing++;
+                continue;
             }
-            if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-                glm_vec3_rotate(world->ship->pointing_direction, delta, (vec3) {0.0f, 1.0f, 0.0f});
+            vec3 location;
+            float angle;
+            net_reckon_smooth(entity, snapshot->tick, location, &angle);
+            double error = glm_vec3_distance(location, head->this->location);
+            error_total += error;
+            error_max = fmax(error_max, error);
+            compared++;
+        }
+    }
+    printf("client error: %.3f avg, %.3f max over %i entities, %.2f degrees max rotation, %i missing\n",
+           compared ? error_total / compared : 0.0, error_max, compared, angle_error_max, missing);
+
+    return missing > 0;
+}
+
+int main(int argc, char *argv[]) {
+    options_t options = {
+        .headless = false,
+        .profile = false,
+        .width = 1920,
+        .height = 1080,
+        .frames = 600,
+        .dump_every = 0,
+        .dump_prefix = "frame",
+        .seed = time(0),
+        .seed_given = false,
+        .pacing_mode = PACING_UNCAPPED,
+        .fps = 0.0,
+        .frames_in_flight = 1,
+        .load_snapshot_path = NULL,
+        .save_snapshot_path = NULL,
+        .checkpoint_every = 0,
+        .sort_draws = true,
+        .depth_prepass = false,
+        .analytic_shadows = false,
+        .target_gpu_ms = 0.0f,
+        .asteroids = 20,
+        .server_port = -1,
+        .connect_address = NULL,
+        .net_clients = 0,
+        .sectors = false,
+        .sector_cache_kb = DEFAULT_SECTOR_CACHE_KB,
+        .counters_json_path = NULL,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            options.headless = true;
+            if (sscanf(argv[++i], "%ix%i", &options.width, &options.height) != 2) {
+                fprintf(stderr, "Resolution should look like 1920x1080\n");
+                return 1;
             }
-            if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-                vec3 axis;
-                glm_vec3_cross((vec3) {0.0f, 1.0f, 0.0f}, world->ship->pointing_direction, axis);
-                glm_vec3_rotate(world->ship->pointing_direction, -delta, axis);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc) {
+            options.dump_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-prefix") == 0 && i + 1 < argc) {
+            options.dump_prefix = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = atoi(argv[++i]);
+            options.seed_given = true;
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            if (parse_pacing_mode(argv[++i], &options.pacing_mode)) {
+                fprintf(stderr, "Pacing should be uncapped, vsync, capped or low-latency\n");
+                return 1;
             }
-            if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-                vec3 axis;
-                glm_vec3_cross((vec3) {0.0f, 1.0f, 0.0f}, world->ship->pointing_direction, axis);
-                glm_vec3_rotate(world->ship->pointing_direction, delta, axis);
+            if (options.pacing_mode == PACING_CAPPED && options.fps == 0.0)
+                options.fps = 144.0;
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            options.fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            options.frames_in_flight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+            options.load_snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            options.save_snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            options.checkpoint_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unsorted") == 0) {
+            options.sort_draws = false;
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            options.depth_prepass = true;
+        } else if (strcmp(argv[i], "--shadows") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "analytic") != 0 && strcmp(argv[i], "map") != 0) {
+                fprintf(stderr, "Shadows should be analytic or map\n");
+                return 1;
             }
+            options.analytic_shadows = strcmp(argv[i], "analytic") == 0;
+        } else if (strcmp(argv[i], "--dynamic-resolution") == 0 && i + 1 < argc) {
+            options.target_gpu_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--asteroids") == 0 && i + 1 < argc) {
+            options.asteroids = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            options.server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            options.connect_address = argv[++i];
+        } else if (strcmp(argv[i], "--net-bench") == 0 && i + 1 < argc) {
+            options.net_clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sectors") == 0) {
+            options.sectors = true;
+        } else if (strcmp(argv[i], "--sector-cache") == 0 && i + 1 < argc) {
+            options.sector_cache_kb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--counters-json") == 0 && i + 1 < argc) {
+            options.counters_json_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options.profile = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
         }
-
-        render(window, world);
-
-        glfwPollEvents();
     }
 
-    return 0;
+    // Benchmarks are repeatable unless asked for another seed
+    if ((options.headless || options.net_clients > 0) && !options.seed_given)
+        options.seed = 1;
+    seed_random(options.seed);
+    if (options.sectors && multiplayer(&options)) {
+        fprintf(stderr, "Sectors only work in single player\n");
+        return 1;
+    }
+    int error;
+    if (options.net_clients > 0)
+        error = run_net_bench(&options);
+    else if (options.server_port >= 0)
+        error = run_server(&options);
+    else if (options.connect_address)
+        error = run_client(&options);
+    else if (options.headless)
+        error = run_headless(&options);
+    else
+        error = run_window(&options);
+
+    if (options.counters_json_path && save_counters_json(options.counters_json_path))
+        return 1;
+    return error;
 }
@@ -0,0 +1,514 @@
+#include "net.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// Bits of an entity record saying which fields follow
+#define FIELD_POSITION 1
+#define FIELD_VELOCITY 2
+#define FIELD_ANGLE 4
+#define FIELD_SPIN 8
+#define FIELD_FORM 16
+#define FIELD_AXIS 32
+
+// Scratch space for reading entity sections
+unsigned int *removed_ids;
+int removed_ids_capacity;
+net_entity_t *changed_entities;
+int changed_entities_capacity;
+
+int net_open_socket(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    // Everything polls once per frame or tick, nothing waits on the socket
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int net_resolve(char *host, int port, struct sockaddr_in *address) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) {
+        fprintf(stderr, "Could not resolve %s\n", host);
+        return 1;
+    }
+    memcpy(address, result->ai_addr, sizeof(struct sockaddr_in));
+    address->sin_port = htons(port);
+    freeaddrinfo(result);
+    return 0;
+}
+
+int net_send(int fd, struct sockaddr_in *address, net_packet_t *packet) {
+    if (packet->overflow)
+        return -1;
+    return sendto(fd, packet->data, packet->length, 0, (struct sockaddr *) address, sizeof(struct sockaddr_in));
+}
+
+// Length of the next datagram, or -1 when there is none
+int net_receive(int fd, struct sockaddr_in *address, net_packet_t *packet) {
+    socklen_t address_length = sizeof(struct sockaddr_in);
+    int length = recvfrom(fd, packet->data, NET_MAX_PACKET, 0, (struct sockaddr *) address, &address_length);
+    if (length < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+            perror("recvfrom");
+        return -1;
+    }
+    packet->length = length;
+    packet->position = 0;
+    packet->overflow = false;
+    return length;
+}
+
+void net_begin(net_packet_t *packet, net_message_t type) {
+    packet->length = 0;
+    packet->position = 0;
+    packet->overflow = false;
+    net_write_byte(packet, type);
+}
+
+void net_write_byte(net_packet_t *packet, unsigned int value) {
+    if (packet->length >= NET_MAX_PACKET) {
+        packet->overflow = true;
+        return;
+    }
+    packet->data[packet->length++] = value;
+}
+
+// Seven bits at a time, small numbers take a single byte
+void net_write_varint(net_packet_t *packet, uint32_t value) {
+    while (value >= 0x80) {
+        net_write_byte(packet, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    net_write_byte(packet, value);
+}
+
+// Zigzag, so small negative numbers are small too
+void net_write_signed(net_packet_t *packet, int32_t value) {
+    net_write_varint(packet, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+unsigned int net_read_byte(net_packet_t *packet) {
+    if (packet->position >= packet->length) {
+        packet->overflow = true;
+        return 0;
+    }
+    return packet->data[packet->position++];
+}
+
+uint32_t net_read_varint(net_packet_t *packet) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned int byte = net_read_byte(packet);
+        value |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    packet->overflow = true;
+    return 0;
+}
+
+int32_t net_read_signed(net_packet_t *packet) {
+    uint32_t value = net_read_varint(packet);
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+int16_t net_snorm(float value) {
+    return roundf(glm_clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+void net_unsnorm(int16_t *values, vec3 vector) {
+    for (int i = 0; i < 3; i++)
+        vector[i] = values[i] / 32767.0f;
+    glm_vec3_normalize(vector);
+}
+
+void net_quantize_velocity(vec3 velocity, int32_t *quantized) {
+    for (int i = 0; i < 3; i++)
+        quantized[i] = roundf(velocity[i] / NET_TICK_RATE * NET_POSITION_SCALE * (1 << NET_RATE_BITS));
+}
+
+void net_dequantize_velocity(int32_t *quantized, vec3 velocity) {
+    for (int i = 0; i < 3; i++)
+        velocity[i] = quantized[i] * (float) NET_TICK_RATE / NET_POSITION_SCALE / (1 << NET_RATE_BITS);
+}
+
+int32_t net_quantize_spin(float rotation_speed) {
+    return roundf(rotation_speed / NET_TICK_RATE / (2.0f * GLM_PIf) * NET_ANGLE_SCALE * (1 << NET_RATE_BITS));
+}
+
+float net_dequantize_spin(int32_t spin) {
+    return spin * (float) NET_TICK_RATE * (2.0f * GLM_PIf) / NET_ANGLE_SCALE / (1 << NET_RATE_BITS);
+}
+
+int32_t reckon_value(int32_t value, int32_t rate, int ticks) {
+    return value + (int32_t) (((int64_t) rate * ticks + (1 << (NET_RATE_BITS - 1))) >> NET_RATE_BITS);
+}
+
+// The world wraps like move_objects does it, whatever ends a tick further than
+// max_distance from the origin is mirrored through it. Ticks from the given
+// position in quanta until that happens.
+int ticks_until_wrap(double *position, int32_t *velocity, int limit) {
+    double rate[3];
+    for (int i = 0; i < 3; i++)
+        rate[i] = velocity[i] / (double) (1 << NET_RATE_BITS);
+    double a = rate[0] * rate[0] + rate[1] * rate[1] + rate[2] * rate[2];
+    double b = position[0] * rate[0] + position[1] * rate[1] + position[2] * rate[2];
+    double edge = max_distance * NET_POSITION_SCALE;
+    double c = position[0] * position[0] + position[1] * position[1] + position[2] * position[2] - edge * edge;
+    if (a == 0.0)
+        return limit + 1;
+    double exit = (-b + sqrt(fmax(b * b - a * c, 0.0))) / a;
+    return fmax(fmin(floor(exit) + 1.0, limit + 1.0), 1.0);
+}
+
+// Where the entity is at a tick in quanta, the same integer arithmetic runs on
+// both ends so the server knows exactly what clients extrapolate. Predicting
+// wraps saves a correction for every asteroid that crosses the edge.
+void net_reckon(net_entity_t *entity, int tick, int32_t *position, int32_t *angle) {
+    int ticks = tick - entity->reference_tick;
+    memcpy(position, entity->position, sizeof(entity->position));
+    while (ticks > 0) {
+        double start[3] = {position[0], position[1], position[2]};
+        int wrap = ticks_until_wrap(start, entity->velocity, ticks);
+        if (wrap > ticks)
+            break;
+        for (int i = 0; i < 3; i++)
+            position[i] = -reckon_value(position[i], entity->velocity[i], wrap);
+        ticks -= wrap;
+    }
+    for (int i = 0; i < 3; i++)
+        position[i] = reckon_value(position[i], entity->velocity[i], ticks);
+    *angle = reckon_value(entity->angle, entity->spin, tick - entity->reference_tick) & 0xffff;
+}
+
+// Same for drawing, at a fractional tick in world units and radians. Wraps
+// only happen on whole ticks, so the rest is a straight line.
+void net_reckon_smooth(net_entity_t *entity, float tick, vec3 location, float *angle) {
+    int whole = floorf(tick);
+    float fraction = (tick - whole) / (1 << NET_RATE_BITS);
+    int32_t position[3], whole_angle;
+    net_reckon(entity, whole, position, &whole_angle);
+    for (int i = 0; i < 3; i++)
+        location[i] = (position[i] + entity->velocity[i] * fraction) / NET_POSITION_SCALE;
+    float ticks = tick - entity->reference_tick;
+    *angle = (entity->angle + entity->spin * ticks / (1 << NET_RATE_BITS)) * (2.0f * GLM_PIf / NET_ANGLE_SCALE);
+}
+
+void net_write_input(net_packet_t *packet, net_input_t *input) {
+    net_write_varint(packet, input->ack_tick);
+    for (int i = 0; i < 3; i++)
+        net_write_signed(packet, input->pointing[i]);
+    net_write_byte(packet, input->thrust + 1);
+    net_write_varint(packet, input->fire_count);
+    net_write_byte(packet, input->respawn);
+}
+
+void net_read_input(net_packet_t *packet, net_input_t *input) {
+    input->ack_tick = net_read_varint(packet);
+    for (int i = 0; i < 3; i++)
+        input->pointing[i] = net_read_signed(packet);
+    int thrust = net_read_byte(packet);
+    input->thrust = thrust <= 2 ? thrust - 1 : 0;
+    input->fire_count = net_read_varint(packet);
+    input->respawn = net_read_byte(packet);
+}
+
+void net_reserve_entities(net_entity_t **entities, int *capacity, int length) {
+    if (*entities && length <= *capacity)
+        return;
+    while (*capacity < length)
+        *capacity = *capacity ? *capacity * 2 : 256;
+    *entities = realloc(*entities, *capacity * sizeof(net_entity_t));
+}
+
+void net_copy_snapshot(net_snapshot_t *from, net_snapshot_t *to) {
+    to->tick = from->tick;
+    to->score = from->score;
+    memcpy(to->ships, from->ships, sizeof(from->ships));
+    net_reserve_entities(&to->asteroids, &to->asteroids_capacity, from->asteroids_length);
+    memcpy(to->asteroids, from->asteroids, from->asteroids_length * sizeof(net_entity_t));
+    to->asteroids_length = from->asteroids_length;
+    net_reserve_entities(&to->bullets, &to->bullets_capacity, from->bullets_length);
+    memcpy(to->bullets, from->bullets, from->bullets_length * sizeof(net_entity_t));
+    to->bullets_length = from->bullets_length;
+}
+
+net_entity_t *net_find_entity(net_entity_t *entities, int length, unsigned int id) {
+    int low = 0, high = length;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (entities[middle].id < id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < length && entities[low].id == id)
+        return &entities[low];
+    return NULL;
+}
+
+bool same_entity(net_entity_t *a, net_entity_t *b) {
+    return a->reference_tick == b->reference_tick
+        && memcmp(a->position, b->position, sizeof(a->position)) == 0
+        && memcmp(a->velocity, b->velocity, sizeof(a->velocity)) == 0
+        && a->angle == b->angle && a->spin == b->spin
+        && a->shape == b->shape && a->size == b->size
+        && memcmp(a->axis, b->axis, sizeof(a->axis)) == 0;
+}
+
+// Fields are sent as differences from what the baseline entity reckons to at
+// the new reference tick, new entities are compared against all zeros
+void write_entity(net_packet_t *packet, net_entity_t *entity, net_entity_t *baseline, int tick) {
+    int32_t position[3], angle;
+    net_reckon(baseline, entity->reference_tick, position, &angle);
+    int16_t angle_difference = entity->angle - angle;
+
+    unsigned int fields = 0;
+    if (memcmp(entity->position, position, sizeof(position)) != 0)
+        fields |= FIELD_POSITION;
+    if (memcmp(entity->velocity, baseline->velocity, sizeof(baseline->velocity)) != 0)
+        fields |= FIELD_VELOCITY;
+    if (angle_difference != 0)
+        fields |= FIELD_ANGLE;
+    if (entity->spin != baseline->spin)
+        fields |= FIELD_SPIN;
+    if (entity->shape != baseline->shape || entity->size != baseline->size)
+        fields |= FIELD_FORM;
+    if (memcmp(entity->axis, baseline->axis, sizeof(baseline->axis)) != 0)
+        fields |= FIELD_AXIS;
+
+    net_write_byte(packet, fields);
+    net_write_varint(packet, tick - entity->reference_tick);
+    if (fields & FIELD_POSITION)
+        for (int i = 0; i < 3; i++)
+            net_write_signed(packet, entity->position[i] - position[i]);
+    if (fields & FIELD_VELOCITY)
+        for (int i = 0; i < 3; i++)
+            net_write_signed(packet, entity->velocity[i] - baseline->velocity[i]);
+    if (fields & FIELD_ANGLE)
+        net_write_signed(packet, angle_difference);
+    if (fields & FIELD_SPIN)
+        net_write_signed(packet, entity->spin - baseline->spin);
+    if (fields & FIELD_FORM) {
+        net_write_byte(packet, entity->shape);
+        net_write_varint(packet, entity->size);
+    }
+    if (fields & FIELD_AXIS)
+        for (int i = 0; i < 3; i++)
+            net_write_signed(packet, entity->axis[i] - baseline->axis[i]);
+}
+
+void read_entity(net_packet_t *packet, net_entity_t *baseline, int tick, net_entity_t *entity) {
+    *entity = *baseline;
+    unsigned int fields = net_read_byte(packet);
+    entity->reference_tick = tick - (int) net_read_varint(packet);
+
+    int32_t position[3], angle;
+    net_reckon(baseline, entity->reference_tick, position, &angle);
+    for (int i = 0; i < 3; i++)
+        entity->position[i] = position[i] + (fields & FIELD_POSITION ? net_read_signed(packet) : 0);
+    if (fields & FIELD_VELOCITY)
+        for (int i = 0; i < 3; i++)
+            entity->velocity[i] += net_read_signed(packet);
+    entity->angle = (angle + (fields & FIELD_ANGLE ? net_read_signed(packet) : 0)) & 0xffff;
+    if (fields & FIELD_SPIN)
+        entity->spin += net_read_signed(packet);
+    if (fields & FIELD_FORM) {
+        entity->shape = net_read_byte(packet);
+        entity->size = net_read_varint(packet);
+    }
+    if (fields & FIELD_AXIS)
+        for (int i = 0; i < 3; i++)
+            entity->axis[i] += net_read_signed(packet);
+}
+
+// Ids of entities gone since the baseline, then the entities that are new or
+// have a new reference state. Entities still following their old reference
+// state cost nothing, which is most asteroids on most ticks.
+void write_entities(net_packet_t *packet, net_entity_t *entities, int length,
+                    net_entity_t *baseline, int baseline_length, int tick) {
+    int removed = 0, changed = 0;
+    for (int i = 0, j = 0; i < length || j < baseline_length;) {
+        if (j >= baseline_length || (i < length && entities[i].id < baseline[j].id)) {
+            changed++;
+            i++;
+        } else if (i >= length || baseline[j].id < entities[i].id) {
+            removed++;
+            j++;
+        } else {
+            if (!same_entity(&entities[i], &baseline[j]))
+                changed++;
+            i++;
+            j++;
+        }
+    }
+
+    // Ids are increasing, so only the gaps between them are sent
+    net_write_varint(packet, removed);
+    unsigned int last_id = 0;
+    for (int i = 0, j = 0; j < baseline_length; j++) {
+        while (i < length && entities[i].id < baseline[j].id)
+            i++;
+        if (i < length && entities[i].id == baseline[j].id)
+            continue;
+        net_write_varint(packet, baseline[j].id - last_id);
+        last_id = baseline[j].id;
+    }
+
+    net_write_varint(packet, changed);
+    last_id = 0;
+    net_entity_t empty = {0};
+    for (int i = 0, j = 0; i < length; i++) {
+        while (j < baseline_length && baseline[j].id < entities[i].id)
+            j++;
+        net_entity_t *previous = &empty;
+        if (j < baseline_length && baseline[j].id == entities[i].id) {
+            previous = &baseline[j];
+            if (same_entity(&entities[i], previous))
+                continue;
+        }
+        net_write_varint(packet, entities[i].id - last_id);
+        last_id = entities[i].id;
+        write_entity(packet, &entities[i], previous, tick);
+    }
+}
+
+void read_entities(net_packet_t *packet, net_entity_t **entities, int *length, int *capacity,
+                   net_entity_t *baseline, int baseline_length, int tick) {
+    int removed = net_read_varint(packet);
+    if (removed > baseline_length) {
+        packet->overflow = true;
+        return;
+    }
+    if (removed > removed_ids_capacity) {
+        removed_ids_capacity = removed;
+        removed_ids = realloc(removed_ids, removed_ids_capacity * sizeof(unsigned int));
+    }
+    unsigned int last_id = 0;
+    for (int i = 0; i < removed; i++)
+        removed_ids[i] = last_id += net_read_varint(packet);
+
+    // Every record is at least three bytes, anything claiming more is garbage
+    int changed = net_read_varint(packet);
+    if (changed > (packet->length - packet->position) / 3) {
+        packet->overflow = true;
+        return;
+    }
+    net_reserve_entities(&changed_entities, &changed_entities_capacity, changed);
+    last_id = 0;
+    net_entity_t empty = {0};
+    for (int i = 0; i < changed; i++) {
+        unsigned int id = last_id += net_read_varint(packet);
+        net_entity_t *previous = net_find_entity(baseline, baseline_length, id);
+        read_entity(packet, previous ? previous : &empty, tick, &changed_entities[i]);
+        changed_entities[i].id = id;
+    }
+    if (packet->overflow)
+        return;
+
+    // Merge the baseline with the changes, both are sorted by id
+    net_reserve_entities(entities, capacity, baseline_length + changed);
+    int count = 0;
+    for (int i = 0, j = 0, r = 0; i < baseline_length || j < changed;) {
+        if (j < changed && (i >= baseline_length || changed_entities[j].id <= baseline[i].id)) {
+            if (i < baseline_length && baseline[i].id == changed_entities[j].id)
+                i++;
+            (*entities)[count++] = changed_entities[j++];
+        } else {
+            while (r < removed && removed_ids[r] < baseline[i].id)
+                r++;
+            if (r >= removed || removed_ids[r] != baseline[i].id)
+                (*entities)[count++] = baseline[i];
+            i++;
+        }
+    }
+    *length = count;
+}
+
+void net_write_snapshot(net_packet_t *packet, net_snapshot_t *snapshot, net_snapshot_t *baseline) {
+    net_snapshot_t empty = {0};
+    if (!baseline)
+        baseline = &empty;
+
+    net_begin(packet, NET_SNAPSHOT);
+    net_write_varint(packet, snapshot->tick);
+    net_write_varint(packet, baseline->tick ? snapshot->tick - baseline->tick : 0);
+    net_write_varint(packet, snapshot->score);
+
+    // Ships change every tick while flying, they are always sent
+    unsigned int connected = 0;
+    for (int i = 0; i < NET_MAX_CLIENTS; i++)
+        if (snapshot->ships[i].connected)
+            connected |= 1 << i;
+    net_write_varint(packet, connected);
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        if (!snapshot->ships[i].connected)
+            continue;
+        net_entity_t *previous = &empty.ships[0].state;
+        if (baseline->ships[i].connected)
+            previous = &baseline->ships[i].state;
+        net_write_byte(packet, snapshot->ships[i].alive);
+        write_entity(packet, &snapshot->ships[i].state, previous, snapshot->tick);
+    }
+
+    write_entities(packet, snapshot->asteroids, snapshot->asteroids_length,
+                   baseline->asteroids, baseline->asteroids_length, snapshot->tick);
+    write_entities(packet, snapshot->bullets, snapshot->bullets_length,
+                   baseline->bullets, baseline->bullets_length, snapshot->tick);
+}
+
+// Baseline tick is 0 for full snapshots
+void net_read_snapshot_header(net_packet_t *packet, int *tick, int *baseline_tick) {
+    *tick = net_read_varint(packet);
+    int distance = net_read_varint(packet);
+    *baseline_tick = distance ? *tick - distance : 0;
+}
+
+void net_read_snapshot(net_packet_t *packet, int tick, net_snapshot_t *baseline, net_snapshot_t *snapshot) {
+    net_snapshot_t empty = {0};
+    if (!baseline)
+        baseline = &empty;
+
+    snapshot->tick = tick;
+    snapshot->score = net_read_varint(packet);
+
+    unsigned int connected = net_read_varint(packet);
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        net_ship_t *ship = &snapshot->ships[i];
+        ship->connected = connected & (1 << i);
+        if (!ship->connected)
+            continue;
+        net_entity_t *previous = &empty.ships[0].state;
+        if (baseline->ships[i].connected)
+            previous = &baseline->ships[i].state;
+        ship->alive = net_read_byte(packet);
+        read_entity(packet, previous, tick, &ship->state);
+    }
+
+    read_entities(packet, &snapshot->asteroids, &snapshot->asteroids_length, &snapshot->asteroids_capacity,
+                  baseline->asteroids, baseline->asteroids_length, tick);
+    read_entities(packet, &snapshot->bullets, &snapshot->bullets_length, &snapshot->bullets_capacity,
+                  baseline->bullets, baseline->bullets_length, tick);
+}
@@ -0,0 +1,125 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "world.h"
+
+#define NET_PROTOCOL_VERSION 1
+#define NET_TICK_RATE 30
+#define NET_MAX_CLIENTS MAX_PEERS
+// Snapshots kept around as delta baselines, a client that acks nothing newer
+// than this many ticks ago gets full snapshots again
+#define NET_HISTORY 64
+#define NET_MAX_PACKET 65507
+// What IPv4 and UDP add to every datagram, for bandwidth reports
+#define NET_PACKET_OVERHEAD 28
+
+// Positions are in 1/16 units, velocities in those per tick with 8 more
+// fraction bits. Angles are in 1/65536 turns, spins in those per tick with 8
+// fraction bits, sizes in 1/1024 and directions are snorm16.
+#define NET_POSITION_SCALE 16.0f
+#define NET_RATE_BITS 8
+#define NET_ANGLE_SCALE 65536.0f
+#define NET_SIZE_SCALE 1024.0f
+// The server only sends a new reference state when the client's dead
+// reckoning from the last one drifts further than this, in quanta
+#define NET_POSITION_TOLERANCE 4
+#define NET_ANGLE_TOLERANCE 64
+
+typedef enum {
+    NET_CONNECT,
+    NET_WELCOME,
+    NET_INPUT,
+    NET_SNAPSHOT
+} net_message_t;
+
+// An asteroid, bullet or ship as sent. Position and angle are those at
+// reference_tick, both sides extrapolate from there with the rates.
+typedef struct {
+    unsigned int id;
+    int reference_tick;
+    int32_t position[3];
+    int32_t velocity[3];
+    int32_t angle;
+    int32_t spin;
+    int shape;
+    int32_t size;
+    // Rotation axis of asteroids, pointing direction of ships
+    int16_t axis[3];
+} net_entity_t;
+
+typedef struct {
+    bool connected;
+    bool alive;
+    net_entity_t state;
+} net_ship_t;
+
+// Entity arrays are sorted by id
+typedef struct {
+    int tick;
+    int score;
+    net_ship_t ships[NET_MAX_CLIENTS];
+    net_entity_t *asteroids;
+    int asteroids_length;
+    int asteroids_capacity;
+    net_entity_t *bullets;
+    int bullets_length;
+    int bullets_capacity;
+} net_snapshot_t;
+
+typedef struct {
+    // Newest snapshot the client has, the server sends deltas against it
+    int ack_tick;
+    int16_t pointing[3];
+    // -1, 0 or 1 for braking, drifting or accelerating
+    int thrust;
+    // Total shots requested so far, so lost packets lose no shots
+    unsigned int fire_count;
+    bool respawn;
+} net_input_t;
+
+typedef struct {
+    unsigned char data[NET_MAX_PACKET];
+    int length;
+    int position;
+    // Set when writing past the end or reading garbage, the packet is dropped
+    bool overflow;
+} net_packet_t;
+
+int net_open_socket(int);
+int net_resolve(char *, int, struct sockaddr_in *);
+int net_send(int, struct sockaddr_in *, net_packet_t *);
+int net_receive(int, struct sockaddr_in *, net_packet_t *);
+
+void net_begin(net_packet_t *, net_message_t);
+void net_write_byte(net_packet_t *, unsigned int);
+void net_write_varint(net_packet_t *, uint32_t);
+void net_write_signed(net_packet_t *, int32_t);
+unsigned int net_read_byte(net_packet_t *);
+uint32_t net_read_varint(net_packet_t *);
+int32_t net_read_signed(net_packet_t *);
+
+int16_t net_snorm(float);
+void net_unsnorm(int16_t *, vec3);
+void net_quantize_velocity(vec3, int32_t *);
+void net_dequantize_velocity(int32_t *, vec3);
+int32_t net_quantize_spin(float);
+float net_dequantize_spin(int32_t);
+
+void net_reckon(net_entity_t *, int, int32_t *, int32_t *);
+void net_reckon_smooth(net_entity_t *, float, vec3, float *);
+
+void net_write_input(net_packet_t *, net_input_t *);
+void net_read_input(net_packet_t *, net_input_t *);
+
+void net_reserve_entities(net_entity_t **, int *, int);
+void net_copy_snapshot(net_snapshot_t *, net_snapshot_t *);
+net_entity_t *net_find_entity(net_entity_t *, int, unsigned int);
+
+void net_write_snapshot(net_packet_t *, net_snapshot_t *, net_snapshot_t *);
+void net_read_snapshot_header(net_packet_t *, int *, int *);
+void net_read_snapshot(net_packet_t *, int, net_snapshot_t *, net_snapshot_t *);
+
+#endif
@@ -0,0 +1,145 @@
+#include "occluders.h"
+#include "counters.h"
+#include "state.h"
+
+// Laid out like the std140 uniform block, where the uint arrays are uvec4s
+typedef struct {
+    // Center and radius
+    vec4 spheres[MAX_OCCLUDERS];
+    // First index into cell_spheres in the low 16 bits, count in the high 16
+    GLuint cell_ranges[OCCLUDER_GRID_CELLS];
+    GLuint cell_spheres[MAX_CELL_OCCLUDERS];
+} occluder_block_t;
+
+unsigned int occluder_program;
+GLuint occluder_buffer;
+occluder_block_t occluder_block;
+
+// Cells each sphere covers: lowest u, lowest v, highest u, highest v
+int occluder_cells[MAX_OCCLUDERS][4];
+
+// Bounding spheres make rocks cast shadows far bigger than their faceted
+// silhouettes, the mean distance of the corners matches them better. The
+// bank only exists once there is a world.
+float shape_radii[SHAPE_BANK_LENGTH];
+bool shape_radii_known = false;
+
+float mean_radius(mesh_t *mesh) {
+    float total = 0.0f;
+    for (int i = 0; i < mesh->vertices_length; i++)
+        total += glm_vec3_norm(mesh->vertices[i]);
+    return total / mesh->vertices_length;
+}
+
+void initialize_occluders(unsigned int program) {
+    occluder_program = program;
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "occluders"), 0);
+    glGenBuffers(1, &occluder_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, occluder_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(occluder_block_t), NULL, GL_DYNAMIC_DRAW);
+}
+
+// Anything past MAX_OCCLUDERS casts no shadow on the dust
+int add_occluder(vec3 location, float radius, int length) {
+    if (length < MAX_OCCLUDERS)
+        glm_vec4(location, radius, occluder_block.spheres[length++]);
+    return length;
+}
+
+int cell_of(float coordinate, float min, float cell_size) {
+    return glm_clamp((coordinate - min) / cell_size, 0.0f, OCCLUDER_GRID - 1.0f);
+}
+
+// Gathers the ship, other players and asteroids for this frame's dust
+void update_occluders(world_t *world, vec3 sun_direction) {
+    if (!shape_radii_known) {
+        for (int i = 0; i < SHAPE_BANK_LENGTH; i++)
+            shape_radii[i] = mean_radius(&(shape_bank[i]));
+        shape_radii_known = true;
+    }
+
+    int length = 0;
+    float ship_radius = mean_radius(&(world->ship->mesh));
+    if (world->running)
+        length = add_occluder((vec3) {0.0f, 0.0f, 0.0f}, ship_radius, length);
+    for (int i = 0; i < world->peers_length; i++)
+        length = add_occluder(world->peers[i].location, ship_radius, length);
+    asteroid_list_t *asteroids_head = world->asteroids;
+    while (asteroids_head->this != NULL) {
+        asteroid_t *asteroid = asteroids_head->this;
+        float radius = shape_radii[asteroid->shape] * asteroid->size;
+        length = add_occluder(asteroid->location, radius, length);
+        asteroids_head = asteroids_head->next;
+    }
+
+    // Plane facing the sun, spheres become discs on it
+    vec3 axis_u, axis_v;
+    glm_vec3_cross((vec3) {0.0f, 1.0f, 0.0f}, sun_direction, axis_u);
+    glm_vec3_normalize(axis_u);
+    glm_vec3_cross(sun_direction, axis_u, axis_v);
+
+    vec2 discs[MAX_OCCLUDERS];
+    vec2 grid_min = {INFINITY, INFINITY};
+    vec2 grid_max = {-INFINITY, -INFINITY};
+    for (int i = 0; i < length; i++) {
+        float radius = occluder_block.spheres[i][3];
+        discs[i][0] = glm_vec3_dot(occluder_block.spheres[i], axis_u);
+        discs[i][1] = glm_vec3_dot(occluder_block.spheres[i], axis_v);
+        for (int j = 0; j < 2; j++) {
+            grid_min[j] = fminf(grid_min[j], discs[i][j] - radius);
+            grid_max[j] = fmaxf(grid_max[j], discs[i][j] + radius);
+        }
+    }
+    float cell_size = 1.0f;
+    if (length)
+        cell_size = fmaxf(grid_max[0] - grid_min[0], grid_max[1] - grid_min[1]) / OCCLUDER_GRID;
+    else
+        grid_min[0] = grid_min[1] = 0.0f;
+
+    // Count the spheres per cell, stopping at the first that does not fit
+    int counts[OCCLUDER_GRID_CELLS] = {0};
+    int total = 0;
+    int used = 0;
+    for (; used < length; used++) {
+        float radius = occluder_block.spheres[used][3];
+        int *cells = occluder_cells[used];
+        for (int j = 0; j < 2; j++) {
+            cells[j] = cell_of(discs[used][j] - radius, grid_min[j], cell_size);
+            cells[j + 2] = cell_of(discs[used][j] + radius, grid_min[j], cell_size);
+        }
+        int covered = (cells[2] - cells[0] + 1) * (cells[3] - cells[1] + 1);
+        if (total + covered > MAX_CELL_OCCLUDERS)
+            break;
+        total += covered;
+        for (int v = cells[1]; v <= cells[3]; v++)
+            for (int u = cells[0]; u <= cells[2]; u++)
+                counts[v * OCCLUDER_GRID + u]++;
+    }
+
+    // Then place their indices, cell after cell
+    int next[OCCLUDER_GRID_CELLS];
+    int start = 0;
+    for (int i = 0; i < OCCLUDER_GRID_CELLS; i++) {
+        occluder_block.cell_ranges[i] = start | counts[i] << 16;
+        next[i] = start;
+        start += counts[i];
+    }
+    for (int i = 0; i < used; i++) {
+        int *cells = occluder_cells[i];
+        for (int v = cells[1]; v <= cells[3]; v++)
+            for (int u = cells[0]; u <= cells[2]; u++)
+                occluder_block.cell_spheres[next[v * OCCLUDER_GRID + u]++] = i;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, occluder_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(occluder_block_t), &occluder_block, GL_DYNAMIC_DRAW);
+    count_upload(sizeof(occluder_block_t));
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, occluder_buffer);
+
+    use_program(occluder_program);
+    glUniform3fv(glGetUniformLocation(occluder_program, "sun_direction"), 1, sun_direction);
+    glUniform3fv(glGetUniformLocation(occluder_program, "grid_u"), 1, axis_u);
+    glUniform3fv(glGetUniformLocation(occluder_program, "grid_v"), 1, axis_v);
+    glUniform2fv(glGetUniformLocation(occluder_program, "grid_min"), 1, grid_min);
+    glUniform1f(glGetUniformLocation(occluder_program, "grid_cell_size"), cell_size);
+}
@@ -0,0 +1,20 @@
+#ifndef OCCLUDERS_H
+#define OCCLUDERS_H
+
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "world.h"
+
+// Spheres around everything that casts shadows on the dust, bucketed in
+// a grid on the plane facing the sun. A point is only tested against the
+// spheres of the cell it falls in. Sizes must match dust_analytic_vertices.glsl,
+// the block has to fit in the 16 KB every driver allows.
+#define MAX_OCCLUDERS 512
+#define OCCLUDER_GRID 16
+#define OCCLUDER_GRID_CELLS (OCCLUDER_GRID * OCCLUDER_GRID)
+#define MAX_CELL_OCCLUDERS 1536
+
+void initialize_occluders(unsigned int);
+void update_occluders(world_t *, vec3);
+
+#endif
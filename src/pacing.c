@@ -0,0 +1,145 @@
+#include "pacing.h"
+#include "profiler.h"
+#include <string.h>
+#include <time.h>
+
+// Sleeping is only trusted up to this long before a deadline, the rest is spun
+#define SPIN_MARGIN 0.0015
+
+pacing_mode_t pacing_mode = PACING_UNCAPPED;
+double frame_interval = 0.0;
+int frames_in_flight = 1;
+double refresh_interval = 1.0 / 60.0;
+
+double next_deadline = 0.0;
+double input_time = 0.0;
+
+// Submitted frames whose GPU work is not known to be done yet
+typedef struct {
+    GLsync fence;
+    double input_time;
+} pending_frame_t;
+
+pending_frame_t pending_frames[MAX_FRAMES_IN_FLIGHT];
+int pending_frames_length = 0;
+
+int parse_pacing_mode(char *name, pacing_mode_t *mode) {
+    if (strcmp(name, "uncapped") == 0)
+        *mode = PACING_UNCAPPED;
+    else if (strcmp(name, "vsync") == 0)
+        *mode = PACING_VSYNC;
+    else if (strcmp(name, "capped") == 0)
+        *mode = PACING_CAPPED;
+    else if (strcmp(name, "low-latency") == 0)
+        *mode = PACING_LOW_LATENCY;
+    else
+        return 1;
+    return 0;
+}
+
+void initialize_pacing(pacing_mode_t mode, double fps, int max_frames_in_flight) {
+    pacing_mode = mode;
+    frame_interval = fps > 0.0 ? 1.0 / fps : 0.0;
+    frames_in_flight = max_frames_in_flight;
+    if (frames_in_flight < 1)
+        frames_in_flight = 1;
+    if (frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+        frames_in_flight = MAX_FRAMES_IN_FLIGHT;
+
+    GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode *video_mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+    if (video_mode && video_mode->refreshRate > 0)
+        refresh_interval = 1.0 / video_mode->refreshRate;
+
+    // Leave the driver default alone when uncapped
+    if (mode == PACING_VSYNC)
+        glfwSwapInterval(1);
+    else if (mode != PACING_UNCAPPED)
+        glfwSwapInterval(0);
+
+    next_deadline = profiler_time();
+}
+
+void sleep_until(double deadline) {
+    double remaining = deadline - profiler_time();
+    if (remaining > SPIN_MARGIN) {
+        remaining -= SPIN_MARGIN;
+        struct timespec duration = {(time_t) remaining, (long) ((remaining - (time_t) remaining) * 1e9)};
+        nanosleep(&duration, NULL);
+    }
+    while (profiler_time() < deadline)
+        ;
+}
+
+void drop_oldest_frame() {
+    glDeleteSync(pending_frames[0].fence);
+    pending_frames_length--;
+    memmove(pending_frames, pending_frames + 1, pending_frames_length * sizeof(pending_frame_t));
+}
+
+// Returns 0 when the frame is still on the GPU after waiting. A fence that
+// can not be waited on (lost context) is dropped without a measurement.
+int retire_frame(int wait) {
+    // Oldest pending frame first, fences signal in submission order
+    pending_frame_t *frame = &(pending_frames[0]);
+    GLenum status = glClientWaitSync(frame->fence,
+                                     GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     wait ? 1000000000 : 0);
+    if (status == GL_WAIT_FAILED) {
+        drop_oldest_frame();
+        return 1;
+    }
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return 0;
+
+    // Input to photon: until the GPU is done, then on average half a
+    // refresh to reach the middle of the screen, plus half a refresh of
+    // waiting for vblank when synced.
+    double latency = profiler_time() - frame->input_time + refresh_interval / 2.0;
+    if (pacing_mode == PACING_VSYNC)
+        latency += refresh_interval / 2.0;
+    profiler_record(PROFILE_INPUT_LATENCY, latency);
+
+    drop_oldest_frame();
+    return 1;
+}
+
+void pacing_wait() {
+    profiler_begin(PROFILE_PACING_WAIT);
+
+    // Low latency: do not start a frame while too many are still on the GPU.
+    // A frame that is not done after a second of waiting is given up on, so
+    // a hung GPU costs a second per frame rather than freezing the loop.
+    if (pacing_mode == PACING_LOW_LATENCY)
+        while (pending_frames_length >= frames_in_flight)
+            if (!retire_frame(1))
+                drop_oldest_frame();
+
+    if ((pacing_mode == PACING_CAPPED || pacing_mode == PACING_LOW_LATENCY) && frame_interval > 0.0) {
+        sleep_until(next_deadline);
+        // Do not try to catch up after a long frame, just start over from now
+        next_deadline += frame_interval;
+        if (next_deadline < profiler_time())
+            next_deadline = profiler_time() + frame_interval;
+    }
+
+    profiler_end(PROFILE_PACING_WAIT);
+}
+
+void pacing_input_sampled() {
+    input_time = profiler_time();
+}
+
+void pacing_frame_submitted() {
+    // Outside low latency mode fences are only kept for measuring, a bounded number of them
+    if (pending_frames_length == MAX_FRAMES_IN_FLIGHT && !retire_frame(1))
+        drop_oldest_frame();
+
+    pending_frame_t *frame = &(pending_frames[pending_frames_length++]);
+    frame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame->input_time = input_time;
+    glFlush();
+
+    while (pending_frames_length > 0 && retire_frame(0))
+        ;
+}
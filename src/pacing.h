@@ -0,0 +1,24 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define MAX_FRAMES_IN_FLIGHT 8
+
+typedef enum {
+    PACING_UNCAPPED,
+    PACING_VSYNC,
+    PACING_CAPPED,
+    PACING_LOW_LATENCY
+} pacing_mode_t;
+
+int parse_pacing_mode(char *, pacing_mode_t *);
+
+void initialize_pacing(pacing_mode_t, double, int);
+
+void pacing_wait();
+void pacing_input_sampled();
+void pacing_frame_submitted();
+
+#endif
@@ -0,0 +1,137 @@
+#include "particles.h"
+#include "counters.h"
+#include "state.h"
+#include <string.h>
+
+typedef struct {
+    vec4 position_life;
+    vec4 velocity_lifetime;
+} particle_t;
+
+unsigned int particle_update_program, particle_render_program;
+
+// Particles are ping-ponged between these: one is read while the other is
+// written by transform feedback, so the CPU never touches particle data.
+// Each has a vertex array reading from it.
+GLuint particle_buffers[2];
+GLuint particle_arrays[2];
+int particle_source = 0;
+
+// Next free slot in the ring of particles, bursts overwrite the oldest ones
+int particle_cursor = 0;
+unsigned int particle_seed = 0;
+
+// Time left until every spawned particle has died, nothing to do when <= 0
+float particles_alive_time = 0.0f;
+
+void initialize_particles(unsigned int update_program, unsigned int render_program) {
+    particle_update_program = update_program;
+    particle_render_program = render_program;
+
+    // All particles start out dead (zero life)
+    particle_t *particles = calloc(PARTICLES_LENGTH, sizeof(particle_t));
+
+    glGenBuffers(2, particle_buffers);
+    glGenVertexArrays(2, particle_arrays);
+    for (int i = 0; i < 2; i++) {
+        bind_vertex_array(particle_arrays[i]);
+        bind_array_buffer(particle_buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(particle_t)*PARTICLES_LENGTH, particles, GL_DYNAMIC_COPY);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(particle_t), (void *) 0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(particle_t), (void *) sizeof(vec4));
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+    }
+
+    free(particles);
+}
+
+void update_particles(world_t *world, float delta) {
+    int bursts_length = world->debris_bursts_length;
+    if (bursts_length > MAX_PARTICLE_BURSTS)
+        bursts_length = MAX_PARTICLE_BURSTS;
+
+    particles_alive_time -= delta;
+    if (bursts_length == 0 && particles_alive_time <= 0.0f)
+        return;
+
+    // Hand each burst a range of particle slots, the shader respawns those
+    vec4 burst_locations[MAX_PARTICLE_BURSTS];
+    vec4 burst_velocities[MAX_PARTICLE_BURSTS];
+    int burst_starts[MAX_PARTICLE_BURSTS];
+    int burst_lengths[MAX_PARTICLE_BURSTS];
+    for (int i = 0; i < bursts_length; i++) {
+        debris_burst_t *burst = &(world->debris_bursts[i]);
+        int length = PARTICLES_PER_BURST * burst->size;
+        if (length < 256)
+            length = 256;
+
+        glm_vec4(burst->location, burst->size, burst_locations[i]);
+        glm_vec4(burst->velocity, 0.0f, burst_velocities[i]);
+        burst_starts[i] = particle_cursor;
+        burst_lengths[i] = length;
+        particle_cursor = (particle_cursor + length) % PARTICLES_LENGTH;
+        particles_alive_time = PARTICLE_MAX_LIFETIME;
+    }
+
+    // Keep bursts that did not fit in this frame for the next one
+    world->debris_bursts_length -= bursts_length;
+    memmove(world->debris_bursts,
+            world->debris_bursts + bursts_length,
+            sizeof(debris_burst_t)*world->debris_bursts_length);
+
+    vec3 ship_diff;
+    glm_vec3_scale(world->ship->movement_direction, -delta, ship_diff);
+
+    use_program(particle_update_program);
+    glUniform1f(glGetUniformLocation(particle_update_program, "delta"), delta);
+    glUniform3fv(glGetUniformLocation(particle_update_program, "ship_diff"), 1, ship_diff);
+    glUniform1ui(glGetUniformLocation(particle_update_program, "seed"), particle_seed++);
+    glUniform1i(glGetUniformLocation(particle_update_program, "particles_length"), PARTICLES_LENGTH);
+    glUniform1i(glGetUniformLocation(particle_update_program, "bursts_length"), bursts_length);
+    if (bursts_length > 0) {
+        glUniform4fv(glGetUniformLocation(particle_update_program, "burst_locations"), bursts_length, burst_locations[0]);
+        glUniform4fv(glGetUniformLocation(particle_update_program, "burst_velocities"), bursts_length, burst_velocities[0]);
+        glUniform1iv(glGetUniformLocation(particle_update_program, "burst_starts"), bursts_length, burst_starts);
+        glUniform1iv(glGetUniformLocation(particle_update_program, "burst_lengths"), bursts_length, burst_lengths);
+    }
+
+    // Simulate source into destination without rasterizing anything
+    int destination = 1 - particle_source;
+    bind_vertex_array(particle_arrays[particle_source]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particle_buffers[destination]);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, PARTICLES_LENGTH);
+    counter_add(COUNTER_DRAW_CALLS, 1);
+    glEndTransformFeedback();
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+    particle_source = destination;
+}
+
+void render_particles(mat4 view_matrix, mat4 projection_matrix) {
+    if (particles_alive_time <= 0.0f)
+        return;
+
+    use_program(particle_render_program);
+    glUniformMatrix4fv(glGetUniformLocation(particle_render_program, "view_matrix"), 1, GL_FALSE, view_matrix[0]);
+    glUniformMatrix4fv(glGetUniformLocation(particle_render_program, "projection_matrix"), 1, GL_FALSE, projection_matrix[0]);
+
+    // Additive glow, debris should not occlude itself or write depth
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    bind_vertex_array(particle_arrays[particle_source]);
+    glDrawArrays(GL_POINTS, 0, PARTICLES_LENGTH);
+    counter_add(COUNTER_DRAW_CALLS, 1);
+
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
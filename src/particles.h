@@ -0,0 +1,20 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "world.h"
+
+#define PARTICLES_LENGTH 65536
+#define PARTICLES_PER_BURST 4096
+#define PARTICLE_MAX_LIFETIME 4.0f
+// Must match MAX_BURSTS in particle_update_vertices.glsl
+#define MAX_PARTICLE_BURSTS 16
+
+void initialize_particles(unsigned int, unsigned int);
+
+void update_particles(world_t *, float);
+
+void render_particles(mat4, mat4);
+
+#endif
@@ -0,0 +1,94 @@
+#include "profiler.h"
+#include <time.h>
+#include <GL/glew.h>
+
+typedef struct {
+    double started;
+    double total;
+    double min;
+    double max;
+    int count;
+} profile_stats_t;
+
+const char *profile_section_names[PROFILE_SECTIONS_LENGTH] = {
+    "frame",
+    "update",
+    "collisions",
+    "sectors",
+    "shadow pass",
+    "scene pass",
+    "dust",
+    "particles",
+    "hud",
+    "pacing wait",
+    "input latency",
+    "fragments",
+    "gpu scene",
+    "resolution",
+    "binds",
+    "binds saved",
+};
+
+// Sections are timed in seconds and reported in ms, unless they hold counts
+const char *profile_section_units[PROFILE_SECTIONS_LENGTH] = {
+    [PROFILE_FRAGMENTS_SHADED] = "samples",
+    [PROFILE_RESOLUTION_SCALE] = "%",
+    [PROFILE_BINDS] = "calls",
+    [PROFILE_BINDS_SAVED] = "calls",
+};
+
+bool profiler_synchronous = false;
+
+profile_stats_t profile_stats[PROFILE_SECTIONS_LENGTH];
+
+double profiler_time() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void profiler_begin(profile_section_t section) {
+    if (profiler_synchronous)
+        glFinish();
+    profile_stats[section].started = profiler_time();
+}
+
+void profiler_end(profile_section_t section) {
+    if (profiler_synchronous)
+        glFinish();
+    profiler_record(section, profiler_time() - profile_stats[section].started);
+}
+
+void profiler_record(profile_section_t section, double value) {
+    profile_stats_t *stats = &(profile_stats[section]);
+    if (stats->count == 0 || value < stats->min)
+        stats->min = value;
+    if (stats->count == 0 || value > stats->max)
+        stats->max = value;
+    stats->total += value;
+    stats->count++;
+}
+
+void profiler_reset() {
+    for (int i = 0; i < PROFILE_SECTIONS_LENGTH; i++) {
+        profile_stats[i].total = 0.0;
+        profile_stats[i].count = 0;
+    }
+}
+
+void profiler_report(FILE *file) {
+    fprintf(file, "%-14s %8s %12s %12s %12s %s\n", "section", "count", "avg", "min", "max", "unit");
+    for (int i = 0; i < PROFILE_SECTIONS_LENGTH; i++) {
+        profile_stats_t *stats = &(profile_stats[i]);
+        if (stats->count == 0)
+            continue;
+        double scale = profile_section_units[i] ? 1.0 : 1000.0;
+        fprintf(file, "%-14s %8i %12.3f %12.3f %12.3f %s\n",
+                profile_section_names[i],
+                stats->count,
+                stats->total / stats->count * scale,
+                stats->min * scale,
+                stats->max * scale,
+                profile_section_units[i] ? profile_section_units[i] : "ms");
+    }
+}
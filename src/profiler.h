@@ -0,0 +1,40 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef enum {
+    PROFILE_FRAME,
+    PROFILE_UPDATE,
+    PROFILE_ROCK_COLLISIONS,
+    PROFILE_SECTORS,
+    PROFILE_SHADOW_PASS,
+    PROFILE_SCENE_PASS,
+    PROFILE_DUST,
+    PROFILE_PARTICLES,
+    PROFILE_HUD,
+    PROFILE_PACING_WAIT,
+    PROFILE_INPUT_LATENCY,
+    PROFILE_FRAGMENTS_SHADED,
+    PROFILE_GPU_SCENE,
+    PROFILE_RESOLUTION_SCALE,
+    PROFILE_BINDS,
+    PROFILE_BINDS_SAVED,
+    PROFILE_SECTIONS_LENGTH
+} profile_section_t;
+
+// When set, sections wait for the GPU before reading the clock so GPU work is
+// attributed to the section that issued it. Only sensible when benchmarking.
+extern bool profiler_synchronous;
+
+double profiler_time();
+
+void profiler_begin(profile_section_t);
+void profiler_end(profile_section_t);
+void profiler_record(profile_section_t, double);
+
+void profiler_reset();
+void profiler_report(FILE *);
+
+#endif
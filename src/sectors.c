@@ -0,0 +1,393 @@
+#include "sectors.h"
+#include "counters.h"
+#include "snapshot.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SECTOR_BUCKETS 4096
+
+bool sectors_enabled = false;
+unsigned int sector_seed;
+
+// Generated sectors by coordinates, and from most to least recently used
+sector_t *sector_buckets[SECTOR_BUCKETS];
+sector_t *newest_sector, *oldest_sector;
+size_t sector_cache_bytes;
+// Also used when a snapshot turns sectors on
+size_t sector_cache_limit = DEFAULT_SECTOR_CACHE_KB * 1024;
+bool sector_cache_warned = false;
+int sectors_generated, sectors_evicted;
+
+// The ship's sector and where in it the ship is. Only the difference between
+// sector coordinates is ever turned into a float, so precision does not run
+// out however far the ship flies.
+int ship_sector[3];
+vec3 ship_offset;
+
+typedef struct {
+    int coordinates[3];
+    // Not filled in yet when NULL, otherwise its asteroids are in the world
+    sector_t *sector;
+} active_sector_t;
+
+active_sector_t active_sectors[SECTOR_WINDOW_LENGTH];
+int window_center[3];
+bool dust_outdated;
+
+uint32_t mix_bits(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// Doubles as the random state the sector is generated from, never zero
+uint32_t sector_hash(int *coordinates) {
+    uint32_t h = sector_seed;
+    h = mix_bits(h + (uint32_t) coordinates[0] * 0x8da6b343u);
+    h = mix_bits(h + (uint32_t) coordinates[1] * 0xd8163841u);
+    h = mix_bits(h + (uint32_t) coordinates[2] * 0xcb1ab31fu);
+    return h ? h : 1;
+}
+
+void enable_sectors(size_t cache_bytes, unsigned int seed) {
+    sectors_enabled = true;
+    sector_cache_limit = cache_bytes;
+    sector_seed = mix_bits(seed * 2654435761u + 1);
+}
+
+sector_t *find_sector(int *coordinates) {
+    sector_t *sector = sector_buckets[sector_hash(coordinates) & (SECTOR_BUCKETS - 1)];
+    while (sector && memcmp(sector->coordinates, coordinates, sizeof(sector->coordinates)) != 0)
+        sector = sector->next_in_bucket;
+    return sector;
+}
+
+void unlink_sector(sector_t *sector) {
+    if (sector->newer)
+        sector->newer->older = sector->older;
+    else
+        newest_sector = sector->older;
+    if (sector->older)
+        sector->older->newer = sector->newer;
+    else
+        oldest_sector = sector->newer;
+}
+
+void touch_sector(sector_t *sector) {
+    unlink_sector(sector);
+    sector->newer = NULL;
+    sector->older = newest_sector;
+    if (newest_sector)
+        newest_sector->newer = sector;
+    newest_sector = sector;
+    if (!oldest_sector)
+        oldest_sector = sector;
+}
+
+void evict_sector(sector_t *sector) {
+    sector_t **link = &sector_buckets[sector_hash(sector->coordinates) & (SECTOR_BUCKETS - 1)];
+    while (*link != sector)
+        link = &(*link)->next_in_bucket;
+    *link = sector->next_in_bucket;
+    unlink_sector(sector);
+    sector_cache_bytes -= sector->bytes;
+    sectors_evicted++;
+    free(sector);
+}
+
+// Evicts least recently used sectors outside the window until the bytes fit
+bool make_room(size_t bytes) {
+    sector_t *sector = oldest_sector;
+    while (sector && sector_cache_bytes + bytes > sector_cache_limit) {
+        sector_t *newer = sector->newer;
+        if (!sector->pinned)
+            evict_sector(sector);
+        sector = newer;
+    }
+    return sector_cache_bytes + bytes <= sector_cache_limit;
+}
+
+// Contents only depend on the coordinates and the seed, so an evicted sector
+// comes back the same
+sector_t *generate_sector(int *coordinates) {
+    unsigned int state = sector_hash(coordinates);
+    float chance = random_float_from(&state);
+    int asteroids_length = chance < 0.5f ? 0 : chance < 0.85f ? 1 : 2;
+    int dust_length = SECTOR_DUST_MIN + (int) (random_float_from(&state) * (SECTOR_DUST_MAX - SECTOR_DUST_MIN));
+
+    // One block per sector, the arrays follow the struct
+    size_t bytes = sizeof(sector_t) + asteroids_length * sizeof(asteroid_t) + dust_length * sizeof(vec3);
+    if (!make_room(bytes)) {
+        if (!sector_cache_warned)
+            fprintf(stderr, "Sector cache of %zu KB is too small for the sectors around the ship\n", sector_cache_limit / 1024);
+        sector_cache_warned = true;
+        return NULL;
+    }
+    sector_t *sector = malloc(bytes);
+    memcpy(sector->coordinates, coordinates, sizeof(sector->coordinates));
+    sector->asteroids = (asteroid_t *) (sector + 1);
+    sector->asteroids_length = asteroids_length;
+    sector->dust = (vec3 *) (sector->asteroids + asteroids_length);
+    sector->dust_length = dust_length;
+    sector->bytes = bytes;
+    sector->pinned = false;
+
+    for (int i = 0; i < asteroids_length; i++) {
+        float x = random_float_from(&state) * SECTOR_SIZE;
+        float y = random_float_from(&state) * SECTOR_SIZE;
+        float z = random_float_from(&state) * SECTOR_SIZE;
+        random_asteroid(&sector->asteroids[i], (vec3) {x, y, z}, 1.0f, &state);
+        sector->asteroids[i].id = 0;
+    }
+    for (int i = 0; i < dust_length; i++)
+        for (int j = 0; j < 3; j++)
+            sector->dust[i][j] = random_float_from(&state) * SECTOR_SIZE;
+
+    sector_t **bucket = &sector_buckets[sector_hash(coordinates) & (SECTOR_BUCKETS - 1)];
+    sector->next_in_bucket = *bucket;
+    *bucket = sector;
+    sector->newer = sector->older = NULL;
+    if (!oldest_sector)
+        oldest_sector = sector;
+    else {
+        sector->older = newest_sector;
+        newest_sector->newer = sector;
+    }
+    newest_sector = sector;
+    sector_cache_bytes += bytes;
+    sectors_generated++;
+    return sector;
+}
+
+// Where the sector's lowest corner is as seen from the ship
+void sector_corner(int *coordinates, vec3 corner) {
+    for (int i = 0; i < 3; i++)
+        corner[i] = (coordinates[i] - ship_sector[i]) * SECTOR_SIZE - ship_offset[i];
+}
+
+void populate_sector(world_t *world, active_sector_t *active) {
+    vec3 corner;
+    sector_corner(active->coordinates, corner);
+    for (int i = 0; i < active->sector->asteroids_length; i++) {
+        vec3 location;
+        glm_vec3_add(corner, active->sector->asteroids[i].location, location);
+        if (glm_vec3_norm(location) < SECTOR_SPAWN_CLEARANCE)
+            continue;
+
+        asteroid_t *asteroid = malloc(sizeof(asteroid_t));
+        count_allocation(sizeof(asteroid_t));
+        counter_add(COUNTER_ASTEROIDS_SPAWNED, 1);
+        *asteroid = active->sector->asteroids[i];
+        asteroid->id = next_entity_id++;
+        glm_vec3_copy(location, asteroid->location);
+        world->asteroids = asteroid_list_cons(asteroid, world->asteroids);
+    }
+}
+
+// Centers the window on the ship's sector, keeping what is known about the
+// sectors that stay in it
+void move_window() {
+    active_sector_t previous[SECTOR_WINDOW_LENGTH];
+    memcpy(previous, active_sectors, sizeof(previous));
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++)
+        if (previous[i].sector)
+            previous[i].sector->pinned = false;
+
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++) {
+        active_sector_t *active = &active_sectors[i];
+        int step[3] = {i % SECTOR_WINDOW, i / SECTOR_WINDOW % SECTOR_WINDOW, i / (SECTOR_WINDOW * SECTOR_WINDOW)};
+        int old_step[3];
+        bool kept = true;
+        for (int j = 0; j < 3; j++) {
+            active->coordinates[j] = ship_sector[j] + step[j] - SECTOR_RADIUS;
+            old_step[j] = active->coordinates[j] - window_center[j] + SECTOR_RADIUS;
+            kept &= old_step[j] >= 0 && old_step[j] < SECTOR_WINDOW;
+        }
+        int old_index = old_step[0] + (old_step[1] + old_step[2] * SECTOR_WINDOW) * SECTOR_WINDOW;
+        active->sector = kept ? previous[old_index].sector : NULL;
+        if (active->sector)
+            active->sector->pinned = true;
+    }
+    memcpy(window_center, ship_sector, sizeof(window_center));
+    dust_outdated = true;
+}
+
+// Asteroids that drifted out of the window are gone, they are not wrapped
+void cull_asteroids(world_t *world) {
+    asteroid_list_t *asteroids_head = world->asteroids;
+    asteroid_list_t **link = &(world->asteroids);
+    while (asteroids_head->next != NULL) {
+        bool inside = true;
+        for (int i = 0; i < 3; i++) {
+            int step = floorf((asteroids_head->this->location[i] + ship_offset[i]) / SECTOR_SIZE);
+            inside &= abs(step) <= SECTOR_RADIUS;
+        }
+        asteroid_list_t *next = asteroids_head->next;
+        if (!inside) {
+            *link = next;
+            if (!in_snapshot_block(asteroids_head)) {
+                free(asteroids_head->this);
+                free(asteroids_head);
+            }
+        } else
+            link = &(asteroids_head->next);
+        asteroids_head = next;
+    }
+}
+
+void rebuild_dust(world_t *world) {
+    int length = 0;
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++)
+        if (active_sectors[i].sector)
+            length += active_sectors[i].sector->dust_length;
+
+    dust_cloud_t *dust_cloud = world->dust_cloud;
+    if (dust_cloud->vertices_length != length) {
+        dust_cloud->vertices_length = length;
+        dust_cloud->vertices = realloc(dust_cloud->vertices, sizeof(vec3) * (length + 1));
+    }
+
+    int vertex = 0;
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++) {
+        sector_t *sector = active_sectors[i].sector;
+        if (!sector)
+            continue;
+        vec3 corner;
+        sector_corner(sector->coordinates, corner);
+        for (int j = 0; j < sector->dust_length; j++)
+            glm_vec3_add(corner, sector->dust[j], dust_cloud->vertices[vertex++]);
+    }
+    dust_outdated = false;
+}
+
+// Takes the sector from the cache or generates it, NULL when it does not fit
+sector_t *activate_sector(active_sector_t *active) {
+    sector_t *sector = find_sector(active->coordinates);
+    if (sector)
+        touch_sector(sector);
+    else
+        sector = generate_sector(active->coordinates);
+    if (sector)
+        sector->pinned = true;
+    active->sector = sector;
+    return sector;
+}
+
+// Fills in the whole window at once, as loading
+void start_sectors(world_t *world) {
+    memset(ship_sector, 0, sizeof(ship_sector));
+    glm_vec3_copy((vec3) {SECTOR_SIZE / 2.0f, SECTOR_SIZE / 2.0f, SECTOR_SIZE / 2.0f}, ship_offset);
+    move_window();
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++)
+        if (activate_sector(&active_sectors[i]))
+            populate_sector(world, &active_sectors[i]);
+    rebuild_dust(world);
+}
+
+// Once per frame after the world moved. At most one sector entering the
+// window is filled in per frame, nearest to the ship first, whether it was
+// cached or not so the cache size never changes what happens.
+void update_sectors(world_t *world, float delta) {
+    vec3 moved;
+    glm_vec3_scale(world->ship->movement_direction, delta, moved);
+    glm_vec3_add(ship_offset, moved, ship_offset);
+    bool crossed = false;
+    for (int i = 0; i < 3; i++) {
+        while (ship_offset[i] >= SECTOR_SIZE) {
+            ship_offset[i] -= SECTOR_SIZE;
+            ship_sector[i]++;
+            crossed = true;
+        }
+        while (ship_offset[i] < 0.0f) {
+            ship_offset[i] += SECTOR_SIZE;
+            ship_sector[i]--;
+            crossed = true;
+        }
+    }
+    if (crossed)
+        move_window();
+
+    active_sector_t *missing = NULL;
+    int missing_distance = INT_MAX;
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++) {
+        active_sector_t *active = &active_sectors[i];
+        if (active->sector)
+            continue;
+        int distance = 0;
+        for (int j = 0; j < 3; j++)
+            distance += abs(active->coordinates[j] - ship_sector[j]);
+        if (distance < missing_distance) {
+            missing = active;
+            missing_distance = distance;
+        }
+    }
+    if (missing && activate_sector(missing)) {
+        populate_sector(world, missing);
+        dust_outdated = true;
+    }
+
+    cull_asteroids(world);
+    if (dust_outdated)
+        rebuild_dust(world);
+}
+
+// Also which sectors of the window were filled in, their asteroids are in
+// the world already
+void get_sector_position(int *sector, vec3 offset, unsigned char *filled) {
+    memcpy(sector, ship_sector, sizeof(ship_sector));
+    glm_vec3_copy(ship_offset, offset);
+    memset(filled, 0, SECTOR_WINDOW_BYTES);
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++)
+        if (active_sectors[i].sector)
+            filled[i / 8] |= 1 << (i % 8);
+}
+
+void forget_window() {
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++) {
+        active_sector_t *active = &active_sectors[i];
+        if (active->sector)
+            active->sector->pinned = false;
+        active->sector = NULL;
+    }
+}
+
+void disable_sectors() {
+    forget_window();
+    sectors_enabled = false;
+}
+
+// After loading a snapshot, which decides whether the world is streamed and
+// from which seed. It already holds the asteroids and dust of the window
+// around where it was saved. The same sectors are filled in again without
+// adding asteroids, so later frames go on as they would have.
+void restore_sectors(world_t *world, bool enabled, unsigned int seed, int *sector, vec3 offset, unsigned char *filled) {
+    forget_window();
+    sectors_enabled = enabled;
+    if (!enabled)
+        return;
+    // Cached sectors were generated from the other seed
+    if (seed != sector_seed) {
+        while (oldest_sector)
+            evict_sector(oldest_sector);
+        sector_seed = seed;
+    }
+    memcpy(ship_sector, sector, sizeof(ship_sector));
+    glm_vec3_copy(offset, ship_offset);
+    move_window();
+    for (int i = 0; i < SECTOR_WINDOW_LENGTH; i++)
+        if (filled[i / 8] & 1 << (i % 8))
+            activate_sector(&active_sectors[i]);
+    dust_outdated = false;
+}
+
+void sectors_report(FILE *file) {
+    int cached = 0;
+    for (sector_t *sector = newest_sector; sector; sector = sector->older)
+        cached++;
+    fprintf(file, "sectors: %i generated, %i evicted, %i cached in %zu of %zu KB\n",
+            sectors_generated, sectors_evicted, cached, sector_cache_bytes / 1024, sector_cache_limit / 1024);
+}
@@ -0,0 +1,48 @@
+#ifndef SECTORS_H
+#define SECTORS_H
+
+#include <stdio.h>
+#include "world.h"
+
+#define SECTOR_SIZE 500.0f
+// Sectors up to this many steps from the ship's along every axis are active,
+// which always covers max_distance around the ship
+#define SECTOR_RADIUS 2
+#define SECTOR_WINDOW (2 * SECTOR_RADIUS + 1)
+#define SECTOR_WINDOW_LENGTH (SECTOR_WINDOW * SECTOR_WINDOW * SECTOR_WINDOW)
+// One bit per window sector
+#define SECTOR_WINDOW_BYTES ((SECTOR_WINDOW_LENGTH + 7) / 8)
+#define SECTOR_DUST_MIN 100
+#define SECTOR_DUST_MAX 300
+#define DEFAULT_SECTOR_CACHE_KB 1024
+// No asteroid is put closer than this to the ship when a sector fills in
+#define SECTOR_SPAWN_CLEARANCE 250.0f
+
+// Generated contents of a sector, relative to its lowest corner. Asteroids
+// are templates, the world gets copies whenever the sector becomes active.
+typedef struct sector_t {
+    int coordinates[3];
+    asteroid_t *asteroids;
+    int asteroids_length;
+    vec3 *dust;
+    int dust_length;
+    size_t bytes;
+    // In the active window, never evicted
+    bool pinned;
+    struct sector_t *next_in_bucket;
+    struct sector_t *newer;
+    struct sector_t *older;
+} sector_t;
+
+extern bool sectors_enabled;
+extern unsigned int sector_seed;
+
+void enable_sectors(size_t, unsigned int);
+void disable_sectors();
+void start_sectors(world_t *);
+void update_sectors(world_t *, float);
+void get_sector_position(int *, vec3, unsigned char *);
+void restore_sectors(world_t *, bool, unsigned int, int *, vec3, unsigned char *);
+void sectors_report(FILE *);
+
+#endif
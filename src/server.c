@@ -0,0 +1,372 @@
+#include "server.h"
+#include "collision.h"
+#include "profiler.h"
+#include "counters.h"
+#include <string.h>
+#include <sys/socket.h>
+
+net_packet_t server_packet;
+
+// Entities of the tick being captured, sorted by id before they are compared
+// with the previous tick's
+net_entity_t *capture_entities;
+int capture_entities_capacity;
+
+int start_server(server_t *server, int port) {
+    memset(server, 0, sizeof(server_t));
+    server->socket = net_open_socket(port);
+    if (server->socket < 0)
+        return 1;
+
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    getsockname(server->socket, (struct sockaddr *) &address, &address_length);
+    server->port = ntohs(address.sin_port);
+
+    for (int i = 0; i < NET_MAX_CLIENTS; i++)
+        server->clients[i].ship = create_ship((vec3) {0.0f, 0.0f, -1.0f});
+    return 0;
+}
+
+bool same_address(struct sockaddr_in *a, struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+server_client_t *find_client(server_t *server, struct sockaddr_in *address) {
+    for (int i = 0; i < NET_MAX_CLIENTS; i++)
+        if (server->clients[i].connected && same_address(&server->clients[i].address, address))
+            return &server->clients[i];
+    return NULL;
+}
+
+void respawn_ship(server_client_t *client) {
+    client->alive = true;
+    glm_vec3_copy(GLM_VEC3_ZERO, client->location);
+    glm_vec3_copy(GLM_VEC3_ZERO, client->ship->movement_direction);
+}
+
+void accept_client(server_t *server, struct sockaddr_in *address, net_packet_t *packet) {
+    if (net_read_byte(packet) != NET_PROTOCOL_VERSION || packet->overflow)
+        return;
+
+    // A client whose welcome got lost asks again and keeps its slot
+    server_client_t *client = find_client(server, address);
+    if (!client) {
+        for (int i = 0; i < NET_MAX_CLIENTS && !client; i++)
+            if (!server->clients[i].connected)
+                client = &server->clients[i];
+        if (!client)
+            return;
+
+        ship_t *ship = client->ship;
+        memset(client, 0, sizeof(server_client_t));
+        client->ship = ship;
+        client->connected = true;
+        client->address = *address;
+        glm_vec3_copy((vec3) {0.0f, 0.0f, -1.0f}, ship->pointing_direction);
+        respawn_ship(client);
+    }
+    client->last_heard = server->tick;
+
+    net_begin(&server_packet, NET_WELCOME);
+    net_write_byte(&server_packet, client - server->clients);
+    net_write_byte(&server_packet, NET_TICK_RATE);
+    net_send(server->socket, address, &server_packet);
+}
+
+void receive_input(server_t *server, struct sockaddr_in *address, net_packet_t *packet) {
+    server_client_t *client = find_client(server, address);
+    if (!client)
+        return;
+
+    net_input_t input;
+    net_read_input(packet, &input);
+    if (packet->overflow)
+        return;
+
+    // Inputs can arrive out of order, never go back to an older ack
+    if (input.ack_tick < client->input.ack_tick || input.ack_tick > server->tick)
+        input.ack_tick = client->input.ack_tick;
+    client->input = input;
+    client->last_heard = server->tick;
+}
+
+void receive_packets(server_t *server) {
+    struct sockaddr_in address;
+    while (net_receive(server->socket, &address, &server_packet) >= 0) {
+        unsigned int type = net_read_byte(&server_packet);
+        if (type == NET_CONNECT)
+            accept_client(server, &address, &server_packet);
+        else if (type == NET_INPUT)
+            receive_input(server, &address, &server_packet);
+    }
+}
+
+void apply_input(server_client_t *client, world_t *world, float delta) {
+    ship_t *ship = client->ship;
+    net_input_t *input = &client->input;
+
+    if (!client->alive) {
+        if (input->respawn)
+            respawn_ship(client);
+        // Shots asked for while dead are not fired later
+        client->fired = input->fire_count;
+        return;
+    }
+
+    vec3 pointing;
+    net_unsnorm(input->pointing, pointing);
+    if (glm_vec3_norm2(pointing) > 0.5f)
+        glm_vec3_copy(pointing, ship->pointing_direction);
+
+    vec3 speed_diff;
+    glm_vec3_scale(ship->pointing_direction, delta * 120.0f * input->thrust, speed_diff);
+    glm_vec3_add(ship->movement_direction, speed_diff, ship->movement_direction);
+
+    unsigned int shots = input->fire_count - client->fired;
+    if (shots > SERVER_MAX_SHOTS)
+        shots = SERVER_MAX_SHOTS;
+    client->fired = input->fire_count;
+    for (unsigned int i = 0; i < shots; i++) {
+        vec3 direction;
+        glm_vec3_copy(ship->pointing_direction, direction);
+        bullet_t *bullet = create_bullet(client->location, direction, 700.0 + glm_vec3_norm(ship->movement_direction));
+        world->bullets = bullet_list_cons(bullet, world->bullets);
+    }
+}
+
+// Ships move the same way the world moves around the ship in the normal game
+void move_ship(server_client_t *client, float delta) {
+    if (!client->alive)
+        return;
+
+    ship_t *ship = client->ship;
+    vec3 diff;
+    glm_vec3_scale(ship->movement_direction, delta, diff);
+    glm_vec3_add(client->location, diff, client->location);
+    if (glm_vec3_norm(client->location) > max_distance)
+        glm_vec3_negate(client->location);
+
+    if (ship_collides(ship, client->location)) {
+        client->alive = false;
+        glm_vec3_copy(GLM_VEC3_ZERO, ship->movement_direction);
+    }
+    glm_vec3_scale(ship->movement_direction, powf(0.75f, delta), ship->movement_direction);
+}
+
+int compare_entity_ids(const void *a, const void *b) {
+    unsigned int id_a = ((net_entity_t *) a)->id, id_b = ((net_entity_t *) b)->id;
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+// Keeps the previous reference state while clients' extrapolation of it is
+// still close enough to the truth, so most entities do not change
+void capture_entity(net_entity_t *previous, net_entity_t *entity, int tick) {
+    if (!previous)
+        return;
+
+    int32_t position[3], angle;
+    net_reckon(previous, tick, position, &angle);
+    bool drifted = false;
+    for (int i = 0; i < 3; i++)
+        drifted |= abs(position[i] - entity->position[i]) > NET_POSITION_TOLERANCE;
+    bool turned = abs((int16_t) (angle - entity->angle)) > NET_ANGLE_TOLERANCE;
+    bool accelerated = memcmp(previous->velocity, entity->velocity, sizeof(entity->velocity)) != 0
+        || previous->spin != entity->spin;
+
+    if (!drifted && !turned && !accelerated) {
+        *entity = *previous;
+        return;
+    }
+
+    // Whatever is still within tolerance continues from the old reference, so
+    // the delta only carries the fields that were off
+    if (!drifted)
+        memcpy(entity->position, position, sizeof(position));
+    if (!turned)
+        entity->angle = angle;
+}
+
+void capture_list(net_entity_t **entities, int *capacity, int length,
+                  net_entity_t *previous, int previous_length, int tick) {
+    qsort(capture_entities, length, sizeof(net_entity_t), compare_entity_ids);
+    for (int i = 0, j = 0; i < length; i++) {
+        while (j < previous_length && previous[j].id < capture_entities[i].id)
+            j++;
+        bool existed = j < previous_length && previous[j].id == capture_entities[i].id;
+        capture_entity(existed ? &previous[j] : NULL, &capture_entities[i], tick);
+    }
+
+    net_reserve_entities(entities, capacity, length);
+    memcpy(*entities, capture_entities, length * sizeof(net_entity_t));
+}
+
+void quantize_location(vec3 location, int32_t *position) {
+    for (int i = 0; i < 3; i++)
+        position[i] = roundf(location[i] * NET_POSITION_SCALE);
+}
+
+void capture_snapshot(server_t *server, world_t *world) {
+    net_snapshot_t *snapshot = &server->history[server->tick % NET_HISTORY];
+    net_snapshot_t *previous = &server->history[(server->tick - 1) % NET_HISTORY];
+    net_snapshot_t empty = {0};
+    if (previous->tick != server->tick - 1)
+        previous = &empty;
+
+    snapshot->tick = server->tick;
+    snapshot->score = world->score;
+
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        server_client_t *client = &server->clients[i];
+        net_ship_t *ship = &snapshot->ships[i];
+        memset(ship, 0, sizeof(net_ship_t));
+        ship->connected = client->connected;
+        ship->alive = client->alive;
+        ship->state.id = i;
+        ship->state.reference_tick = server->tick;
+        quantize_location(client->location, ship->state.position);
+        net_quantize_velocity(client->ship->movement_direction, ship->state.velocity);
+        for (int j = 0; j < 3; j++)
+            ship->state.axis[j] = net_snorm(client->ship->pointing_direction[j]);
+    }
+
+    int length = 0;
+    for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next) {
+        net_reserve_entities(&capture_entities, &capture_entities_capacity, length + 1);
+        asteroid_t *asteroid = head->this;
+        net_entity_t *entity = &capture_entities[length++];
+        memset(entity, 0, sizeof(net_entity_t));
+        entity->id = asteroid->id;
+        entity->reference_tick = server->tick;
+        quantize_location(asteroid->location, entity->position);
+        vec3 velocity;
+        glm_vec3_scale(asteroid->direction, asteroid->speed, velocity);
+        net_quantize_velocity(velocity, entity->velocity);
+        entity->angle = (int32_t) roundf(asteroid->angle / (2.0f * GLM_PIf) * NET_ANGLE_SCALE) & 0xffff;
+        entity->spin = net_quantize_spin(asteroid->rotation_speed);
+        entity->shape = asteroid->shape;
+        entity->size = roundf(asteroid->size * NET_SIZE_SCALE);
+        for (int i = 0; i < 3; i++)
+            entity->axis[i] = net_snorm(asteroid->axis[i]);
+    }
+    capture_list(&snapshot->asteroids, &snapshot->asteroids_capacity, length,
+                 previous->asteroids, previous->asteroids_length, server->tick);
+    snapshot->asteroids_length = length;
+
+    length = 0;
+    for (bullet_list_t *head = world->bullets; head->next != NULL; head = head->next) {
+        net_reserve_entities(&capture_entities, &capture_entities_capacity, length + 1);
+        bullet_t *bullet = head->this;
+        net_entity_t *entity = &capture_entities[length++];
+        memset(entity, 0, sizeof(net_entity_t));
+        entity->id = bullet->id;
+        entity->reference_tick = server->tick;
+        quantize_location(bullet->location, entity->position);
+        vec3 velocity;
+        glm_vec3_scale(bullet->direction, bullet->speed, velocity);
+        net_quantize_velocity(velocity, entity->velocity);
+    }
+    capture_list(&snapshot->bullets, &snapshot->bullets_capacity, length,
+                 previous->bullets, previous->bullets_length, server->tick);
+    snapshot->bullets_length = length;
+}
+
+void send_snapshots(server_t *server) {
+    net_snapshot_t *snapshot = &server->history[server->tick % NET_HISTORY];
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        server_client_t *client = &server->clients[i];
+        if (!client->connected)
+            continue;
+
+        // Deltas are against the newest snapshot the client confirmed, as long
+        // as it is still in the history
+        int ack = client->input.ack_tick;
+        net_snapshot_t *baseline = &server->history[ack % NET_HISTORY];
+        if (ack <= 0 || ack <= server->tick - NET_HISTORY || baseline->tick != ack)
+            baseline = NULL;
+
+        net_write_snapshot(&server_packet, snapshot, baseline);
+        if (server_packet.overflow) {
+            fprintf(stderr, "Snapshot of %i asteroids does not fit in a packet\n", snapshot->asteroids_length);
+            continue;
+        }
+        net_send(server->socket, &client->address, &server_packet);
+        client->bytes_sent += server_packet.length + NET_PACKET_OVERHEAD;
+        client->packets_sent++;
+        if (server_packet.length > client->largest_packet)
+            client->largest_packet = server_packet.length;
+    }
+}
+
+// One fixed step: read what clients sent, simulate, send everyone the result.
+// The world is simulated by the same function the normal game uses, with the
+// world's own ship left standing still at the origin.
+void server_tick(server_t *server, world_t *world, void (*simulate)(float)) {
+    double start = profiler_time();
+    float delta = 1.0f / NET_TICK_RATE;
+    server->tick++;
+
+    receive_packets(server);
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        server_client_t *client = &server->clients[i];
+        if (client->connected && server->tick - client->last_heard > SERVER_TIMEOUT_TICKS)
+            client->connected = false;
+        if (client->connected)
+            apply_input(client, world, delta);
+    }
+
+    simulate(delta);
+    // Nobody draws debris on the server
+    world->debris_bursts_length = 0;
+
+    for (int i = 0; i < NET_MAX_CLIENTS; i++)
+        if (server->clients[i].connected)
+            move_ship(&server->clients[i], delta);
+
+    capture_snapshot(server, world);
+    send_snapshots(server);
+    // Includes the bullets clients fired before the simulation
+    counters_end_tick();
+
+    double time = profiler_time() - start;
+    server->tick_time_total += time;
+    if (time > server->tick_time_max)
+        server->tick_time_max = time;
+    server->ticks_measured++;
+}
+
+int server_clients_connected(server_t *server) {
+    int connected = 0;
+    for (int i = 0; i < NET_MAX_CLIENTS; i++)
+        connected += server->clients[i].connected;
+    return connected;
+}
+
+// Traffic and tick times since the last reset, over the given simulated time
+void server_report(server_t *server, FILE *file, double seconds) {
+    net_snapshot_t *snapshot = &server->history[server->tick % NET_HISTORY];
+    fprintf(file, "tick %i: %i clients, %i asteroids, %i bullets, tick %.3f ms avg %.3f ms max\n",
+            server->tick, server_clients_connected(server), snapshot->asteroids_length, snapshot->bullets_length,
+            server->ticks_measured ? server->tick_time_total / server->ticks_measured * 1000.0 : 0.0,
+            server->tick_time_max * 1000.0);
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        server_client_t *client = &server->clients[i];
+        if (!client->connected || client->packets_sent == 0)
+            continue;
+        long payload = client->bytes_sent - (long) client->packets_sent * NET_PACKET_OVERHEAD;
+        fprintf(file, "  client %i: %.0f bytes/s (%.0f without UDP/IP headers), %.1f bytes per snapshot, largest %i\n",
+                i, client->bytes_sent / seconds, payload / seconds,
+                (double) payload / client->packets_sent, client->largest_packet);
+    }
+}
+
+void server_reset_stats(server_t *server) {
+    server->tick_time_total = 0.0;
+    server->tick_time_max = 0.0;
+    server->ticks_measured = 0;
+    for (int i = 0; i < NET_MAX_CLIENTS; i++) {
+        server->clients[i].bytes_sent = 0;
+        server->clients[i].packets_sent = 0;
+        server->clients[i].largest_packet = 0;
+    }
+}
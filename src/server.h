@@ -0,0 +1,47 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "net.h"
+#include "world.h"
+
+// Clients that send nothing for this long lose their slot
+#define SERVER_TIMEOUT_TICKS (5 * NET_TICK_RATE)
+// Shots a client can fire in one tick, the rest of a backlog is dropped
+#define SERVER_MAX_SHOTS 4
+
+typedef struct {
+    bool connected;
+    struct sockaddr_in address;
+    int last_heard;
+    net_input_t input;
+    unsigned int fired;
+    // Only the mesh and pointing direction are used, ships have a location on
+    // the server instead of the world moving around them
+    ship_t *ship;
+    vec3 location;
+    bool alive;
+    // Traffic to this client, including UDP and IP headers
+    long bytes_sent;
+    int packets_sent;
+    int largest_packet;
+} server_client_t;
+
+typedef struct {
+    int socket;
+    int port;
+    int tick;
+    server_client_t clients[NET_MAX_CLIENTS];
+    // What was broadcast at each of the last ticks, the baselines for deltas
+    net_snapshot_t history[NET_HISTORY];
+    double tick_time_total;
+    double tick_time_max;
+    int ticks_measured;
+} server_t;
+
+int start_server(server_t *, int);
+void server_tick(server_t *, world_t *, void (*)(float));
+int server_clients_connected(server_t *);
+void server_report(server_t *, FILE *, double);
+void server_reset_stats(server_t *);
+
+#endif
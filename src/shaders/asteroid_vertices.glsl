@@ -5,13 +5,18 @@ layout (location = 1) in vec3 normal;
 out vec3 fragment_position;
 out vec3 fragment_normal;
 
+// Positions arrive normalized to [-1, 1]
+uniform float position_scale;
 uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
+// Must match depth_vertices.glsl exactly for the depth prepass
+invariant gl_Position;
+
 void main()
 {
-    vec4 fragment_position_vec4 = model_matrix * vec4(position, 1.0);
+    vec4 fragment_position_vec4 = model_matrix * vec4(position * position_scale, 1.0);
     gl_Position = projection_matrix * view_matrix * fragment_position_vec4;
     fragment_position = vec3(fragment_position_vec4);
     fragment_normal = mat3(transpose(inverse(model_matrix))) * normalize(normal);
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+
+// Positions arrive normalized to [-1, 1]
+uniform float position_scale;
+uniform mat4 model_matrix;
+uniform mat4 view_matrix;
+uniform mat4 projection_matrix;
+
+// Must match asteroid_vertices.glsl exactly, the lit pass tests against this
+invariant gl_Position;
+
+void main()
+{
+    vec4 fragment_position_vec4 = model_matrix * vec4(position * position_scale, 1.0);
+    gl_Position = projection_matrix * view_matrix * fragment_position_vec4;
+}
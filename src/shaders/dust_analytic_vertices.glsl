@@ -0,0 +1,50 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+
+// Sizes from occluders.h
+#define MAX_OCCLUDERS 512
+#define OCCLUDER_GRID 16
+#define MAX_CELL_OCCLUDERS 1536
+
+layout (std140) uniform occluders {
+    vec4 spheres[MAX_OCCLUDERS];
+    uvec4 cell_ranges[OCCLUDER_GRID * OCCLUDER_GRID / 4];
+    uvec4 cell_spheres[MAX_CELL_OCCLUDERS / 4];
+};
+
+uniform mat4 view_matrix;
+uniform mat4 projection_matrix;
+uniform vec3 sun_direction;
+uniform vec3 grid_u;
+uniform vec3 grid_v;
+uniform vec2 grid_min;
+uniform float grid_cell_size;
+
+out vec3 fragment_position;
+out float shadow;
+
+void main()
+{
+    gl_Position = projection_matrix * view_matrix * vec4(position, 1.0);
+    fragment_position = position;
+
+    // Only spheres whose disc on the sun facing plane covers the point's cell
+    // can be in the way
+    shadow = 0.0;
+    vec2 cell = floor((vec2(dot(position, grid_u), dot(position, grid_v)) - grid_min) / grid_cell_size);
+    if (any(lessThan(cell, vec2(0.0))) || any(greaterThanEqual(cell, vec2(OCCLUDER_GRID))))
+        return;
+    int index = int(cell.y) * OCCLUDER_GRID + int(cell.x);
+    uint range = cell_ranges[index / 4][index % 4];
+    uint end = (range & 0xffffu) + (range >> 16);
+    for (uint i = range & 0xffffu; i < end; i++) {
+        vec4 sphere = spheres[cell_spheres[i / 4u][i % 4u]];
+        // Towards the sun from the point, and the ray passes within the radius
+        vec3 to_center = sphere.xyz - position;
+        float along = dot(to_center, sun_direction);
+        if (along > 0.0 && dot(to_center, to_center) - along * along < sphere.w * sphere.w) {
+            shadow = 1.0;
+            return;
+        }
+    }
+}
@@ -4,13 +4,21 @@ layout (location = 0) in vec3 position;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 uniform mat4 light_matrix;
+uniform sampler2D depth_map;
 
 out vec3 fragment_position;
-out vec4 fragment_position_shadow;
+out float shadow;
 
 void main()
 {
     gl_Position = projection_matrix * view_matrix * vec4(position, 1.0);
     fragment_position = position;
-    fragment_position_shadow = light_matrix * vec4(position, 1.0);
+
+    // Points are a single sample, so the shadow can be looked up per vertex
+    vec4 position_shadow = light_matrix * vec4(position, 1.0);
+    vec3 shadow_coords = position_shadow.xyz / position_shadow.w;
+    shadow_coords = shadow_coords * 0.5 + 0.5;
+    float closest_depth = textureLod(depth_map, shadow_coords.xy, 0.0).r;
+    float current_depth = shadow_coords.z;
+    shadow = current_depth > closest_depth ? 1.0 : 0.0;
 }
@@ -0,0 +1,19 @@
+#version 330 core
+
+in vec3 fragment_position;
+in float fragment_life;
+
+out vec4 pixel_color;
+
+void main()
+{
+    // Hot and bright when fresh, cooling to dim grey rock dust
+    vec3 color = mix(vec3(0.35, 0.3, 0.25), vec3(1.0, 0.6, 0.2), fragment_life * fragment_life);
+    float light = fragment_life;
+
+    if (length(fragment_position) > 800.0) {
+        light = light * max(1000 - length(fragment_position), 0) / 200.0;
+    }
+
+    pixel_color = light*vec4(color, 1.0);
+}
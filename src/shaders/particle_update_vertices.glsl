@@ -0,0 +1,68 @@
+#version 330 core
+layout (location = 0) in vec4 position_life;
+layout (location = 1) in vec4 velocity_lifetime;
+
+out vec4 next_position_life;
+out vec4 next_velocity_lifetime;
+
+// Must match MAX_PARTICLE_BURSTS in particles.h
+const int MAX_BURSTS = 16;
+
+uniform float delta;
+uniform vec3 ship_diff;
+uniform uint seed;
+uniform int particles_length;
+uniform int bursts_length;
+uniform vec4 burst_locations[MAX_BURSTS];
+uniform vec4 burst_velocities[MAX_BURSTS];
+uniform int burst_starts[MAX_BURSTS];
+uniform int burst_lengths[MAX_BURSTS];
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state) / 4294967295.0;
+}
+
+void main()
+{
+    vec4 position = position_life;
+    vec4 velocity = velocity_lifetime;
+
+    // Respawn the particle if its slot was handed to a burst this frame
+    for (int i = 0; i < bursts_length; i++) {
+        int offset = (gl_VertexID - burst_starts[i] + particles_length) % particles_length;
+        if (offset < burst_lengths[i]) {
+            uint state = uint(gl_VertexID) * 747796405u + seed * 2891336453u;
+            float size = burst_locations[i].w;
+
+            // Random direction, uniform over the sphere
+            float z = random(state) * 2.0 - 1.0;
+            float longitude = random(state) * 6.2831853;
+            vec3 direction = vec3(sqrt(1.0 - z*z) * cos(longitude), sqrt(1.0 - z*z) * sin(longitude), z);
+
+            float lifetime = 1.5 + random(state) * 2.5;
+            position = vec4(burst_locations[i].xyz + direction * random(state) * 24.0 * size, lifetime);
+            velocity = vec4(burst_velocities[i].xyz + direction * (20.0 + random(state) * 180.0) * size, lifetime);
+        }
+    }
+
+    if (position.w > 0.0) {
+        position.xyz += velocity.xyz * delta + ship_diff;
+        velocity.xyz *= pow(0.5, delta);
+        position.w -= delta;
+    }
+
+    next_position_life = position;
+    next_velocity_lifetime = velocity;
+}
@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec4 position_life;
+layout (location = 1) in vec4 velocity_lifetime;
+
+uniform mat4 view_matrix;
+uniform mat4 projection_matrix;
+
+out vec3 fragment_position;
+out float fragment_life;
+
+void main()
+{
+    if (position_life.w <= 0.0) {
+        // Dead particle, place it outside the clip volume
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        gl_PointSize = 1.0;
+    } else {
+        gl_Position = projection_matrix * view_matrix * vec4(position_life.xyz, 1.0);
+        gl_PointSize = clamp(400.0 / gl_Position.w, 1.0, 4.0);
+    }
+    fragment_position = position_life.xyz;
+    fragment_life = position_life.w / velocity_lifetime.w;
+}
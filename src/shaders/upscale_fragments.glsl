@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec2 screen_position;
+
+uniform sampler2D scene;
+uniform vec2 scene_size;
+
+out vec4 pixel_color;
+
+void main()
+{
+    // Only the bottom left scene_size texels hold the scene, keep the filter
+    // from reaching past them
+    vec2 texel = clamp(screen_position * scene_size, vec2(0.5), scene_size - 0.5);
+    pixel_color = texture(scene, texel / textureSize(scene, 0));
+}
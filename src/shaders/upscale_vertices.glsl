@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec2 screen_position;
+
+void main()
+{
+    // One triangle covering the whole screen, no vertex buffer needed
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    screen_position = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
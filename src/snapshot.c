@@ -0,0 +1,265 @@
+#include "snapshot.h"
+#include "sectors.h"
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A snapshot is this header followed by arrays of asteroid_t, bullet_t and
+// dust vertices exactly as they are laid out in memory, each starting at a
+// 16 byte aligned offset. Meshes are not stored, asteroids refer to the shape
+// bank. The format is native endian and tied to the struct layouts, which
+// the header records so a mismatching build refuses the file.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t asteroid_size;
+    uint32_t bullet_size;
+    uint32_t shape_bank_length;
+    uint32_t random_state;
+    uint32_t next_entity_id;
+    int32_t score;
+    int32_t running;
+    uint32_t asteroids_length;
+    uint32_t bullets_length;
+    uint32_t dust_length;
+    vec3 pointing_direction;
+    vec3 movement_direction;
+    // Whether the world is streamed in sectors, from which seed and where
+    // the ship is in them
+    uint32_t sectors;
+    uint32_t sector_seed;
+    int32_t sector[3];
+    vec3 sector_offset;
+    uint8_t sectors_filled[SECTOR_WINDOW_BYTES];
+    uint64_t asteroids_offset;
+    uint64_t bullets_offset;
+    uint64_t dust_offset;
+    uint64_t size;
+} snapshot_header_t;
+
+char *snapshot_block_start, *snapshot_block_end;
+
+size_t align_snapshot_offset(size_t offset) {
+    return (offset + 15) & ~(size_t) 15;
+}
+
+int asteroid_list_length(asteroid_list_t *asteroids) {
+    int length = 0;
+    for (; asteroids->next != NULL; asteroids = asteroids->next)
+        length++;
+    return length;
+}
+
+int bullet_list_length(bullet_list_t *bullets) {
+    int length = 0;
+    for (; bullets->next != NULL; bullets = bullets->next)
+        length++;
+    return length;
+}
+
+void layout_snapshot(world_t *world, snapshot_header_t *header) {
+    memset(header, 0, sizeof(snapshot_header_t));
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->header_size = sizeof(snapshot_header_t);
+    header->asteroid_size = sizeof(asteroid_t);
+    header->bullet_size = sizeof(bullet_t);
+    header->shape_bank_length = SHAPE_BANK_LENGTH;
+
+    header->asteroids_length = asteroid_list_length(world->asteroids);
+    header->bullets_length = bullet_list_length(world->bullets);
+    header->dust_length = world->dust_cloud->vertices_length;
+
+    header->asteroids_offset = align_snapshot_offset(sizeof(snapshot_header_t));
+    header->bullets_offset = align_snapshot_offset(header->asteroids_offset + header->asteroids_length * sizeof(asteroid_t));
+    header->dust_offset = align_snapshot_offset(header->bullets_offset + header->bullets_length * sizeof(bullet_t));
+    header->size = header->dust_offset + header->dust_length * sizeof(vec3);
+}
+
+// Offsets and lengths come from the file, so nothing is added up that could
+// wrap around
+bool snapshot_array_fits(snapshot_header_t *header, uint64_t offset, uint64_t length, size_t element_size) {
+    return offset >= header->header_size
+        && offset <= header->size
+        && length <= (header->size - offset) / element_size;
+}
+
+bool in_snapshot_block(void *pointer) {
+    return (char *) pointer >= snapshot_block_start && (char *) pointer < snapshot_block_end;
+}
+
+size_t snapshot_size(world_t *world) {
+    snapshot_header_t header;
+    layout_snapshot(world, &header);
+    return header.size;
+}
+
+void write_snapshot(world_t *world, void *buffer) {
+    snapshot_header_t header;
+    layout_snapshot(world, &header);
+
+    header.random_state = random_state;
+    header.next_entity_id = next_entity_id;
+    header.score = world->score;
+    header.running = world->running;
+    glm_vec3_copy(world->ship->pointing_direction, header.pointing_direction);
+    glm_vec3_copy(world->ship->movement_direction, header.movement_direction);
+    header.sectors = sectors_enabled;
+    header.sector_seed = sectors_enabled ? sector_seed : 0;
+    get_sector_position(header.sector, header.sector_offset, header.sectors_filled);
+
+    char *bytes = buffer;
+    memset(bytes, 0, header.size);
+    memcpy(bytes, &header, sizeof(snapshot_header_t));
+
+    asteroid_t *asteroids = (asteroid_t *) (bytes + header.asteroids_offset);
+    for (asteroid_list_t *head = world->asteroids; head->next != NULL; head = head->next)
+        *(asteroids++) = *(head->this);
+
+    bullet_t *bullets = (bullet_t *) (bytes + header.bullets_offset);
+    for (bullet_list_t *head = world->bullets; head->next != NULL; head = head->next)
+        *(bullets++) = *(head->this);
+
+    memcpy(bytes + header.dust_offset, world->dust_cloud->vertices, header.dust_length * sizeof(vec3));
+}
+
+int read_snapshot(world_t *world, const void *buffer, size_t length) {
+    const char *bytes = buffer;
+    snapshot_header_t header;
+    if (length < sizeof(snapshot_header_t)) {
+        fprintf(stderr, "Snapshot is truncated\n");
+        return 1;
+    }
+    memcpy(&header, bytes, sizeof(snapshot_header_t));
+
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Not a version %i snapshot\n", SNAPSHOT_VERSION);
+        return 1;
+    }
+    if (header.header_size != sizeof(snapshot_header_t)
+        || header.asteroid_size != sizeof(asteroid_t)
+        || header.bullet_size != sizeof(bullet_t)
+        || header.shape_bank_length != SHAPE_BANK_LENGTH) {
+        fprintf(stderr, "Snapshot was written by an incompatible build\n");
+        return 1;
+    }
+    if (header.size > length
+        || !snapshot_array_fits(&header, header.asteroids_offset, header.asteroids_length, sizeof(asteroid_t))
+        || !snapshot_array_fits(&header, header.bullets_offset, header.bullets_length, sizeof(bullet_t))
+        || !snapshot_array_fits(&header, header.dust_offset, header.dust_length, sizeof(vec3))) {
+        fprintf(stderr, "Snapshot is truncated\n");
+        return 1;
+    }
+    // Shapes index the bank when drawing, colliding and casting shadows
+    const asteroid_t *stored_asteroids = (const asteroid_t *) (bytes + header.asteroids_offset);
+    for (size_t i = 0; i < header.asteroids_length; i++) {
+        if (stored_asteroids[i].shape < 0 || stored_asteroids[i].shape >= SHAPE_BANK_LENGTH) {
+            fprintf(stderr, "Snapshot has an asteroid of unknown shape %i\n", stored_asteroids[i].shape);
+            return 1;
+        }
+    }
+
+    // Asteroids and bullets are copied as one block each, list nodes and all,
+    // the lists are just threaded through them. The previous ones are leaked
+    // like everywhere else.
+    // The checks above bound both counts by the file size
+    size_t asteroids_length = header.asteroids_length;
+    asteroid_list_t *asteroid_nodes = malloc((asteroids_length + 1) * sizeof(asteroid_list_t)
+                                             + asteroids_length * sizeof(asteroid_t));
+    asteroid_t *asteroids = (asteroid_t *) (asteroid_nodes + asteroids_length + 1);
+    snapshot_block_start = (char *) asteroid_nodes;
+    snapshot_block_end = (char *) (asteroids + asteroids_length);
+    memcpy(asteroids, bytes + header.asteroids_offset, asteroids_length * sizeof(asteroid_t));
+    for (size_t i = 0; i < asteroids_length; i++) {
+        asteroid_nodes[i].this = &(asteroids[i]);
+        asteroid_nodes[i].next = &(asteroid_nodes[i + 1]);
+    }
+    asteroid_nodes[asteroids_length].this = NULL;
+    asteroid_nodes[asteroids_length].next = NULL;
+    world->asteroids = asteroid_nodes;
+
+    size_t bullets_length = header.bullets_length;
+    bullet_list_t *bullet_nodes = malloc((bullets_length + 1) * sizeof(bullet_list_t)
+                                         + bullets_length * sizeof(bullet_t));
+    bullet_t *bullets = (bullet_t *) (bullet_nodes + bullets_length + 1);
+    memcpy(bullets, bytes + header.bullets_offset, bullets_length * sizeof(bullet_t));
+    for (size_t i = 0; i < bullets_length; i++) {
+        bullet_nodes[i].this = &(bullets[i]);
+        bullet_nodes[i].next = &(bullet_nodes[i + 1]);
+    }
+    bullet_nodes[bullets_length].this = NULL;
+    bullet_nodes[bullets_length].next = NULL;
+    world->bullets = bullet_nodes;
+
+    dust_cloud_t *dust_cloud = world->dust_cloud;
+    if (dust_cloud->vertices_length != header.dust_length) {
+        dust_cloud->vertices_length = header.dust_length;
+        dust_cloud->vertices = realloc(dust_cloud->vertices, sizeof(vec3)*dust_cloud->vertices_length);
+    }
+    memcpy(dust_cloud->vertices, bytes + header.dust_offset, header.dust_length * sizeof(vec3));
+
+    random_state = header.random_state;
+    next_entity_id = header.next_entity_id;
+    world->score = header.score;
+    world->running = header.running;
+    glm_vec3_copy(header.pointing_direction, world->ship->pointing_direction);
+    glm_vec3_copy(header.movement_direction, world->ship->movement_direction);
+    world->debris_bursts_length = 0;
+    restore_sectors(world, header.sectors, header.sector_seed, header.sector, header.sector_offset, header.sectors_filled);
+
+    return 0;
+}
+
+int save_snapshot(world_t *world, char *path) {
+    size_t size = snapshot_size(world);
+    void *buffer = malloc(size);
+    write_snapshot(world, buffer);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        free(buffer);
+        return 1;
+    }
+    size_t written = fwrite(buffer, 1, size, file);
+    fclose(file);
+    free(buffer);
+
+    if (written != size) {
+        fprintf(stderr, "Could not write snapshot to %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int load_snapshot(world_t *world, char *path) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        fprintf(stderr, "Could not open snapshot %s\n", path);
+        return 1;
+    }
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        fprintf(stderr, "Snapshot %s is empty\n", path);
+        close(file);
+        return 1;
+    }
+
+    // Read straight out of the page cache, no parsing pass
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map snapshot %s\n", path);
+        return 1;
+    }
+
+    int error = read_snapshot(world, mapping, status.st_size);
+    munmap(mapping, status.st_size);
+
+    return error;
+}
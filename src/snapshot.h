@@ -0,0 +1,23 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include "world.h"
+
+// "CMTS" when read as bytes on little endian machines
+#define SNAPSHOT_MAGIC 0x53544d43
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_PATH "comets.snapshot"
+
+size_t snapshot_size(world_t *);
+void write_snapshot(world_t *, void *);
+int read_snapshot(world_t *, const void *, size_t);
+
+// True for list nodes and asteroids of the last loaded snapshot, which are
+// one block and can not be freed on their own
+bool in_snapshot_block(void *);
+
+int save_snapshot(world_t *, char *);
+int load_snapshot(world_t *, char *);
+
+#endif
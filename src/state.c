@@ -0,0 +1,57 @@
+#include "state.h"
+#include <stdbool.h>
+
+// No object has this name, so the first bind after forgetting always happens
+#define UNKNOWN_BINDING ((GLuint) -1)
+
+GLuint bound_program = UNKNOWN_BINDING;
+GLuint bound_array_buffer = UNKNOWN_BINDING;
+GLuint bound_texture = UNKNOWN_BINDING;
+GLuint bound_vertex_array = UNKNOWN_BINDING;
+
+int binds_made = 0, binds_saved = 0;
+
+// True when the bind has to happen
+bool change_binding(GLuint *bound, GLuint name) {
+    if (*bound == name) {
+        binds_saved++;
+        return false;
+    }
+    *bound = name;
+    binds_made++;
+    return true;
+}
+
+void use_program(GLuint program) {
+    if (change_binding(&bound_program, program))
+        glUseProgram(program);
+}
+
+void bind_array_buffer(GLuint buffer) {
+    if (change_binding(&bound_array_buffer, buffer))
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+}
+
+// Only texture unit 0 is ever used
+void bind_texture(GLuint texture) {
+    if (change_binding(&bound_texture, texture))
+        glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void bind_vertex_array(GLuint vertex_array) {
+    if (change_binding(&bound_vertex_array, vertex_array))
+        glBindVertexArray(vertex_array);
+}
+
+void forget_state() {
+    bound_program = UNKNOWN_BINDING;
+    bound_array_buffer = UNKNOWN_BINDING;
+    bound_texture = UNKNOWN_BINDING;
+    bound_vertex_array = UNKNOWN_BINDING;
+}
+
+void take_bind_counts(int *made, int *saved) {
+    *made = binds_made;
+    *saved = binds_saved;
+    binds_made = binds_saved = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <GL/glew.h>
+
+// Remembers the bound program, array buffer, 2D texture and vertex array, and
+// skips binding what is already bound. Anything that binds behind its back
+// (glText) has to be followed by forget_state().
+void use_program(GLuint);
+void bind_array_buffer(GLuint);
+void bind_texture(GLuint);
+void bind_vertex_array(GLuint);
+
+void forget_state();
+
+// Binds made and skipped since the last call
+void take_bind_counts(int *, int *);
+
+#endif
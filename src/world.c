@@ -1,6 +1,41 @@
 #include "world.h"
+#include "counters.h"
+#include <string.h>
+
+mesh_t shape_bank[SHAPE_BANK_LENGTH];
+bool shape_bank_created = false;
+
+// Game randomness comes from here instead of rand() so that the state can be
+// saved and restored along with the world.
+unsigned int random_state = 1;
+
+// Ids are handed out in creation order, zero is never used
+unsigned int next_entity_id = 1;
+
+float random_float_from(unsigned int *state) {
+    // xorshift32, never reaches zero from a non-zero state
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) / 16777215.0f;
+}
+
+float random_float() {
+    return random_float_from(&random_state);
+}
+
+void seed_random(unsigned int seed) {
+    random_state = seed * 2654435761u;
+    if (random_state == 0)
+        random_state = 1;
+}
+
+void create_shape_bank();
 
 world_t *create_world() {
+    if (!shape_bank_created)
+        create_shape_bank();
+
     world_t *world = malloc(sizeof(world_t));
     world->asteroids = create_asteroid_list();
     world->dust_cloud = create_dust_cloud();
@@ -8,19 +43,32 @@ world_t *create_world() {
     world->ship = create_ship((vec3) {0.0f, 0.0f, -1.0f});
     world->score = 0;
     world->running = true;
+    world->debris_bursts_length = 0;
+    world->peers_length = 0;
 
     return world;
 }
 
+void add_debris_burst(world_t *world, vec3 location, vec3 velocity, float size) {
+    // Bursts are consumed by the particle system once per frame, drop any excess
+    if (world->debris_bursts_length >= MAX_DEBRIS_BURSTS)
+        return;
+
+    debris_burst_t *burst = &(world->debris_bursts[world->debris_bursts_length++]);
+    glm_vec3_copy(location, burst->location);
+    glm_vec3_copy(velocity, burst->velocity);
+    burst->size = size;
+}
+
 dust_cloud_t *create_dust_cloud() {
     dust_cloud_t *dust_cloud = malloc(sizeof(dust_cloud_t));
     dust_cloud->vertices_length = 25000;
     dust_cloud->vertices = malloc(sizeof(vec3)*dust_cloud->vertices_length);
 
     for (int i = 0; i < dust_cloud->vertices_length; i++) {
-        float longitude = rand() / (float) RAND_MAX * 3.14159 * 2;
-        float colatitude = rand() / (float) RAND_MAX * 3.14159;
-        float distance = cbrt(rand() / (float) RAND_MAX) * max_distance;
+        float longitude = random_float() * 3.14159 * 2;
+        float colatitude = random_float() * 3.14159;
+        float distance = cbrt(random_float()) * max_distance;
         vec3 spawn_location = { distance * cos(longitude) * sin(colatitude),
                                 distance * sin(longitude) * sin(colatitude),
                                 distance * cos(colatitude) };
@@ -41,122 +89,139 @@ void make_normal(vec3 a, vec3 b, vec3 c, vec3 n) {
     }
 }
 
-void make_vertex(float longitude, float colatitude, float radius, float variation, vec3 vec) {
-    radius = radius + rand() / (float) RAND_MAX * variation - variation / 2;
+void make_vertex(float longitude, float colatitude, float radius, float variation, unsigned int *state, vec3 vec) {
+    radius = radius + random_float_from(state) * variation - variation / 2;
     vec[0] = radius*cos(longitude)*sin(colatitude);
     vec[1] = radius*cos(colatitude);
     vec[2] = radius*sin(longitude)*sin(colatitude);
 }
 
-asteroid_t *create_asteroid(vec3 location, float radius, float variation) {
-    asteroid_t *asteroid = malloc(sizeof(asteroid_t));
+float mesh_bounding_radius(vec3 *vertices, int vertices_length) {
+    float bounding_radius = 0.0f;
+    for (int i = 0; i < vertices_length; i++)
+        if (glm_vec3_norm(vertices[i]) > bounding_radius)
+            bounding_radius = glm_vec3_norm(vertices[i]);
+    return bounding_radius;
+}
+
+void create_shape(mesh_t *shape, float radius, float variation, unsigned int *state) {
+    // Top, bands of 6, 12 and 6 corners, bottom
+    shape->vertices_length = 26;
+    shape->vertices = malloc(shape->vertices_length * sizeof(vec3));
+    shape->indices_length = 48*3;
+    shape->indices = malloc(shape->indices_length * sizeof(unsigned char));
+
+    const int top = 0, first_band = 1, second_band = 7, third_band = 19, bottom = 25;
+    vec3 *vertices = shape->vertices;
 
-    asteroid->vertices_length = 48*3;
-    asteroid->vertices = malloc(asteroid->vertices_length * sizeof(vec3));
-    asteroid->normals = malloc(asteroid->vertices_length * sizeof(vec3));
-    
-    vec3 top;
-    make_vertex(0.0f, 0.0f, radius, variation, top);
-    vec3 first_band[6];
+    make_vertex(0.0f, 0.0f, radius, variation, state, vertices[top]);
     for (int i = 0; i < 6; i++) {
         float longitude = 3.14159f / 3 * i;
         float colatitude = 3.14159f / 4;
-        make_vertex(longitude, colatitude, radius, variation, first_band[i]);
+        make_vertex(longitude, colatitude, radius, variation, state, vertices[first_band + i]);
     }
-    vec3 second_band[12];
     for (int i = 0; i < 12; i++) {
         float longitude = 3.14159f / 6 * i;
         float colatitude = 3.14159f / 2;
-        make_vertex(longitude, colatitude, radius, variation, second_band[i]);
+        make_vertex(longitude, colatitude, radius, variation, state, vertices[second_band + i]);
     }
-    vec3 third_band[6];
     for (int i = 0; i < 6; i++) {
         float longitude = 3.14159f / 3 * i;
         float colatitude = 3 * 3.14159f / 4;
-        make_vertex(longitude, colatitude, radius, variation, third_band[i]);
+        make_vertex(longitude, colatitude, radius, variation, state, vertices[third_band + i]);
     }
-    vec3 bottom;
-    make_vertex(0.0f, 3.14159f, radius, variation, bottom);
+    make_vertex(0.0f, 3.14159f, radius, variation, state, vertices[bottom]);
 
     // First triangle band
+    unsigned char *indices = shape->indices;
     int v = 0;
     for (int i = 0; i < 6; i++) {
-        glm_vec3_copy(top, asteroid->vertices[v++]);
-        glm_vec3_copy(first_band[i], asteroid->vertices[v++]);
-        glm_vec3_copy(first_band[(i+1)%6], asteroid->vertices[v++]);
+        indices[v++] = top;
+        indices[v++] = first_band + i;
+        indices[v++] = first_band + (i+1)%6;
     }
 
     // Second triangle band */
     for (int i = 0; i < 6; i++) {
-        glm_vec3_copy(first_band[i], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(first_band[(i+1)%6], asteroid->vertices[v++]);
-        
-        glm_vec3_copy(second_band[i*2], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(first_band[i], asteroid->vertices[v++]);
-
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[(i*2+2)%12], asteroid->vertices[v++]);
-        glm_vec3_copy(first_band[(i+1)%6], asteroid->vertices[v++]);
+        indices[v++] = first_band + i;
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = first_band + (i+1)%6;
+
+        indices[v++] = second_band + i*2;
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = first_band + i;
+
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = second_band + (i*2+2)%12;
+        indices[v++] = first_band + (i+1)%6;
     }
-    
+
     // Third triangle band
     for (int i = 0; i < 6; i++) {
-        glm_vec3_copy(third_band[i], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(third_band[(i+1)%6], asteroid->vertices[v++]);
-        
-        glm_vec3_copy(second_band[i*2], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(third_band[i], asteroid->vertices[v++]);
-
-        glm_vec3_copy(second_band[i*2+1], asteroid->vertices[v++]);
-        glm_vec3_copy(second_band[(i*2+2)%12], asteroid->vertices[v++]);
-        glm_vec3_copy(third_band[(i+1)%6], asteroid->vertices[v++]);
+        indices[v++] = third_band + i;
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = third_band + (i+1)%6;
+
+        indices[v++] = second_band + i*2;
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = third_band + i;
+
+        indices[v++] = second_band + i*2+1;
+        indices[v++] = second_band + (i*2+2)%12;
+        indices[v++] = third_band + (i+1)%6;
     }
 
     // Fourth triangle band
     for (int i = 0; i < 6; i++) {
-        glm_vec3_copy(bottom, asteroid->vertices[v++]);
-        glm_vec3_copy(third_band[i], asteroid->vertices[v++]);
-        glm_vec3_copy(third_band[(i+1)%6], asteroid->vertices[v++]);
+        indices[v++] = bottom;
+        indices[v++] = third_band + i;
+        indices[v++] = third_band + (i+1)%6;
     }
 
-    // Make normals
-    for (int i = 0; i < 36; i++)
-        for (int j = 0; j < 3; j++)
-            make_normal(asteroid->vertices[i*3],
-                        asteroid->vertices[i*3+1],
-                        asteroid->vertices[i*3+2],
-                        asteroid->normals[i*3+j]);
+    shape->bounding_radius = mesh_bounding_radius(shape->vertices, shape->vertices_length);
+    shape->vbo = 0;
+    shape->vao = 0;
+}
+
+void create_shape_bank() {
+    // Shapes have their own random sequence, so the bank is the same in every
+    // run and asteroids can refer to shapes by index alone.
+    unsigned int state = 0x2545f491;
+    for (int i = 0; i < SHAPE_BANK_LENGTH; i++)
+        create_shape(&(shape_bank[i]), ASTEROID_SIZE, ASTEROID_VARIATION, &state);
+    shape_bank_created = true;
+}
+
+asteroid_t *create_asteroid(vec3 location, float size) {
+    asteroid_t *asteroid = malloc(sizeof(asteroid_t));
+    count_allocation(sizeof(asteroid_t));
+    counter_add(COUNTER_ASTEROIDS_SPAWNED, 1);
+
+    asteroid->id = next_entity_id++;
+    random_asteroid(asteroid, location, size, &random_state);
+
+    return asteroid;
+}
 
+// Everything but the id, drawn from the given random sequence
+void random_asteroid(asteroid_t *asteroid, vec3 location, float size, unsigned int *state) {
+    asteroid->shape = (int) (random_float_from(state) * SHAPE_BANK_LENGTH) % SHAPE_BANK_LENGTH;
+    asteroid->size = size;
     glm_vec3_copy(location, asteroid->location);
 
-    asteroid->rotation_speed = rand() / (float) RAND_MAX * 0.25f;
+    asteroid->rotation_speed = random_float_from(state) * 0.25f;
     for (int i = 0; i < 3; i++)
-        asteroid->axis[i] = rand() / (float) RAND_MAX;
+        asteroid->axis[i] = random_float_from(state);
     glm_vec3_normalize(asteroid->axis);
-    asteroid->angle = rand() / (float) RAND_MAX * 3.14159 * 2;
+    asteroid->angle = random_float_from(state) * 3.14159 * 2;
 
-    glm_vec3_copy((vec3) {rand() / (float) RAND_MAX,
-                              rand() / (float) RAND_MAX,
-                              rand() / (float) RAND_MAX},
-        asteroid->direction);
+    // One at a time, so the order does not depend on the compiler
+    float x = random_float_from(state);
+    float y = random_float_from(state);
+    float z = random_float_from(state);
+    glm_vec3_copy((vec3) {x, y, z}, asteroid->direction);
     glm_vec3_normalize(asteroid->direction);
-    asteroid->speed = rand() / (float) RAND_MAX * 250;
-
-    glGenBuffers(1, &(asteroid->vbo));
-    glGenBuffers(1, &(asteroid->nbo));
-
-    glBindBuffer(GL_ARRAY_BUFFER, asteroid->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*asteroid->vertices_length, asteroid->vertices, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, asteroid->nbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*asteroid->vertices_length, asteroid->normals, GL_DYNAMIC_DRAW);
-
-    asteroid->size = 1.0f;
-
-    return asteroid;
+    asteroid->speed = random_float_from(state) * 250;
 }
 
 asteroid_list_t *create_asteroid_list() {
@@ -170,6 +235,7 @@ asteroid_list_t *create_asteroid_list() {
 
 asteroid_list_t *asteroid_list_cons(asteroid_t* asteroid, asteroid_list_t* asteroids) {
     asteroid_list_t *node = malloc(sizeof(asteroid_list_t));
+    count_allocation(sizeof(asteroid_list_t));
 
     node->this = asteroid;
     node->next = asteroids;
@@ -179,8 +245,9 @@ asteroid_list_t *asteroid_list_cons(asteroid_t* asteroid, asteroid_list_t* aster
 
 bullet_t *create_bullet(vec3 location, vec3 direction, float speed) {
     bullet_t *bullet = malloc(sizeof(bullet_t));
-    bullet->vertices = malloc(2 * sizeof(vec3));
+    count_allocation(sizeof(bullet_t));
 
+    bullet->id = next_entity_id++;
     glm_vec3_copy(location, bullet->location);
     glm_vec3_copy(direction, bullet->direction);
     glm_vec3_normalize(direction);
@@ -202,6 +269,7 @@ bullet_list_t *create_bullet_list() {
 
 bullet_list_t *bullet_list_cons(bullet_t* bullet, bullet_list_t* bullets) {
     bullet_list_t *node = malloc(sizeof(bullet_list_t));
+    count_allocation(sizeof(bullet_list_t));
 
     node->this = bullet;
     node->next = bullets;
@@ -215,47 +283,52 @@ ship_t *create_ship(vec3 direction) {
     glm_vec3_copy(GLM_VEC3_ZERO, ship->movement_direction);
     glm_vec3_copy(direction, ship->pointing_direction);
 
-    vec3 vertices[5] = {{0.0f, 0.0f, -2.0f}, // front       0
-                        {-1.0f, 0.0f, 1.0f}, // back, left  1
-                        {1.0f, 0.0f, 1.0f}, // back, right  2
-                        {0.0f, 0.2f, 1.0f}, // back, up     3
-                        {0.0f, -0.2f, 1.0f}}; // back, down 4
-
-    ship->vertices = malloc(6*3*sizeof(vec3)); // 6 surfaces of 3 vertices
-    ship->normals = malloc(6*3*sizeof(vec3)); // idem
-
-    glm_vec3_copy(vertices[0], ship->vertices[0]);
-    glm_vec3_copy(vertices[1], ship->vertices[1]);
-    glm_vec3_copy(vertices[3], ship->vertices[2]);
-
-    glm_vec3_copy(vertices[0], ship->vertices[3]);
-    glm_vec3_copy(vertices[2], ship->vertices[4]);
-    glm_vec3_copy(vertices[3], ship->vertices[5]);
-
-    glm_vec3_copy(vertices[0], ship->vertices[6]);
-    glm_vec3_copy(vertices[1], ship->vertices[7]);
-    glm_vec3_copy(vertices[4], ship->vertices[8]);
-
-    glm_vec3_copy(vertices[0], ship->vertices[9]);
-    glm_vec3_copy(vertices[2], ship->vertices[10]);
-    glm_vec3_copy(vertices[4], ship->vertices[11]);
+    ship->mesh.vertices_length = SHIP_VERTICES_LENGTH;
+    ship->mesh.vertices = malloc(ship->mesh.vertices_length*sizeof(vec3));
+    glm_vec3_copy((vec3) {0.0f, 0.0f, -2.0f}, ship->mesh.vertices[0]); // front
+    glm_vec3_copy((vec3) {-1.0f, 0.0f, 1.0f}, ship->mesh.vertices[1]); // back, left
+    glm_vec3_copy((vec3) {1.0f, 0.0f, 1.0f}, ship->mesh.vertices[2]); // back, right
+    glm_vec3_copy((vec3) {0.0f, 0.2f, 1.0f}, ship->mesh.vertices[3]); // back, up
+    glm_vec3_copy((vec3) {0.0f, -0.2f, 1.0f}, ship->mesh.vertices[4]); // back, down
+
+    // 6 surfaces of 3 vertices
+    unsigned char indices[SHIP_INDICES_LENGTH] = {0, 1, 3,
+                                                  0, 2, 3,
+                                                  0, 1, 4,
+                                                  0, 2, 4,
+                                                  3, 1, 4,
+                                                  3, 2, 4};
+    ship->mesh.indices_length = SHIP_INDICES_LENGTH;
+    ship->mesh.indices = malloc(ship->mesh.indices_length*sizeof(unsigned char));
+    memcpy(ship->mesh.indices, indices, sizeof(indices));
+
+    ship->mesh.bounding_radius = mesh_bounding_radius(ship->mesh.vertices, ship->mesh.vertices_length);
+    ship->mesh.vbo = 0;
+    ship->mesh.vao = 0;
 
-    glm_vec3_copy(vertices[3], ship->vertices[12]);
-    glm_vec3_copy(vertices[1], ship->vertices[13]);
-    glm_vec3_copy(vertices[4], ship->vertices[14]);
+    return ship;
+}
 
-    glm_vec3_copy(vertices[3], ship->vertices[15]);
-    glm_vec3_copy(vertices[2], ship->vertices[16]);
-    glm_vec3_copy(vertices[4], ship->vertices[17]);
+// Turns the ship's mesh to where it is pointing, the ship itself stays put
+void ship_model_matrix(ship_t *ship, mat4 matrix) {
+    pointing_model_matrix(ship->pointing_direction, matrix);
+}
 
-    for (int i = 0; i < 6; i++) {
-        for (int j = i * 3; j < i * 3 + 3; j++) {
-            make_normal(ship->vertices[i*3],
-                        ship->vertices[i*3+1],
-                        ship->vertices[i*3+2],
-                        ship->normals[j]);
-        }
-    }
-    
-    return ship;
+void pointing_model_matrix(vec3 pointing_direction, mat4 matrix) {
+    glm_mat4_identity(matrix);
+
+    // Rotate ship in xz-plane
+    float angle;
+    vec3 axis;
+    glm_vec3_cross(pointing_direction, (vec3) {0.0f, 1.0f, 0.0f}, axis);
+    angle = glm_vec3_angle(pointing_direction, (vec3) {pointing_direction[0], 0.0f, pointing_direction[2]});
+    if (pointing_direction[1] < 0.0f)
+        angle *= -1;
+    glm_rotate(matrix, angle, axis);
+
+    // Rotate ship y-component
+    angle = glm_vec3_angle((vec3) {pointing_direction[0], 0.0f, pointing_direction[2]}, (vec3) {0.0f, 0.0f, -1.0f});
+    if (pointing_direction[0] < 0.0f)
+        angle *= -1;
+    glm_rotate(matrix, angle, (vec3) {0.0f, -1.0f, 0.0f});
 }
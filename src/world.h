@@ -8,13 +8,34 @@
 #include <cglm/cglm.h>
 
 #define max_distance 1000.0f
+#define MAX_DEBRIS_BURSTS 64
+#define SHAPE_BANK_LENGTH 64
+#define ASTEROID_SIZE 24.0f
+#define ASTEROID_VARIATION 12.0f
+#define SHIP_VERTICES_LENGTH 5
+#define SHIP_INDICES_LENGTH 18
+#define MAX_PEERS 16
 
 typedef struct {
+    // Unique corners, triangles index into them three at a time
     int vertices_length;
     vec3 *vertices;
-    vec3 *normals;
+    int indices_length;
+    unsigned char *indices;
+    float bounding_radius;
+    // Packed copy of the mesh on the GPU and the vertex array reading it,
+    // uploaded when first drawn
     GLuint vbo;
-    GLuint nbo;
+    GLuint vao;
+} mesh_t;
+
+// Asteroids hold no pointers so they can be copied around as plain bytes,
+// their mesh is one of the shapes in the bank scaled by size.
+typedef struct {
+    // Stays the same for the asteroid's whole life, also across snapshots
+    // and the network
+    unsigned int id;
+    int shape;
     vec3 location;
     float rotation_speed;
     vec3 direction;
@@ -25,15 +46,15 @@ typedef struct {
 } asteroid_t;
 
 typedef struct {
-    vec3 *vertices;
+    unsigned int id;
+    vec3 vertices[2];
     vec3 direction;
     vec3 location;
     float speed;
 } bullet_t;
 
 typedef struct {
-    vec3* vertices;
-    vec3* normals;
+    mesh_t mesh;
     vec3 pointing_direction;
     vec3 movement_direction;
 } ship_t;
@@ -43,6 +64,18 @@ typedef struct {
     vec3 *vertices;
 } dust_cloud_t;
 
+typedef struct {
+    vec3 location;
+    vec3 velocity;
+    float size;
+} debris_burst_t;
+
+// Another player's ship, only drawn
+typedef struct {
+    vec3 location;
+    vec3 pointing_direction;
+} peer_t;
+
 typedef struct asteroid_list_t {
     asteroid_t *this;
     struct asteroid_list_t *next;
@@ -60,13 +93,29 @@ typedef struct {
     ship_t *ship;
     int score;
     bool running;
+    debris_burst_t debris_bursts[MAX_DEBRIS_BURSTS];
+    int debris_bursts_length;
+    peer_t peers[MAX_PEERS];
+    int peers_length;
 } world_t;
 
+extern mesh_t shape_bank[SHAPE_BANK_LENGTH];
+extern unsigned int random_state;
+extern unsigned int next_entity_id;
+
+void seed_random(unsigned int);
+float random_float();
+float random_float_from(unsigned int *);
+
 world_t *create_world();
+void add_debris_burst(world_t *, vec3, vec3, float);
 
 dust_cloud_t *create_dust_cloud();
 
-asteroid_t *create_asteroid(vec3, float, float);
+void make_normal(vec3, vec3, vec3, vec3);
+
+asteroid_t *create_asteroid(vec3, float);
+void random_asteroid(asteroid_t *, vec3, float, unsigned int *);
 asteroid_list_t *create_asteroid_list();
 asteroid_list_t *asteroid_list_cons(asteroid_t*, asteroid_list_t*);
 
@@ -76,4 +125,7 @@ bullet_list_t *bullet_list_cons(bullet_t *, bullet_list_t *);
 
 ship_t *create_ship(vec3);
 
+void pointing_model_matrix(vec3, mat4);
+void ship_model_matrix(ship_t *, mat4);
+
 #endif